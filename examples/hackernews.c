@@ -1,64 +1,523 @@
 #define _XOPEN_SOURCE 700
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <curl/curl.h>
 #include "libmcp.h"
 #include "cJSON.h"
+#include "stb.h"
 #include "sds.h"
+#include "http.h"
 
 #define HN_BASE_URL "https://hacker-news.firebaseio.com/v0"
 
-static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp)
+/* Requests in flight at once */
+#define HN_MAX_PARALLEL 16
+/* Tool calls of a JSON-RPC batch run at once */
+#define HN_BATCH_PARALLEL 4
+/* Most ids per get_items or get_users call */
+#define HN_BATCH_MAX 500
+#define HN_TIMEOUT 30L
+/* Default time a tool call may take, in milliseconds */
+#define HN_TOOL_TIMEOUT (60 * 1000)
+
+/* One per thread running tools, so connections to the API are reused.
+ * Pools are not thread safe and batched calls run on several threads. */
+static pthread_key_t hn_pool_key;
+
+static void hn_pool_free(void* pool)
 {
-    size_t realsize = size * nmemb;
-    char** s = (char**)userp;
-    size_t oldlen = *s ? strlen(*s) : 0;
-    char* new_s = realloc(*s, oldlen + realsize + 1);
-    if (!new_s) return 0;
-    *s = new_s;
-    memcpy(*s + oldlen, contents, realsize);
-    (*s)[oldlen + realsize] = '\0';
-    return realsize;
+    http_pool_destroy(pool);
 }
 
-static cJSON* hn_get(const char* path)
+static HttpPool* hn_pool()
+{
+    HttpPool* pool = pthread_getspecific(hn_pool_key);
+    if (pool == NULL) {
+        pool = http_pool_create(HN_MAX_PARALLEL);
+        pthread_setspecific(hn_pool_key, pool);
+    }
+    return pool;
+}
+
+/* Tool calls fetching from the API right now, and when the last one ended.
+ * The prefetcher only runs while these show the client is idle. */
+static atomic_int hn_client_active = 0;
+static atomic_llong hn_client_last_ms = 0;
+
+static long long hn_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void hn_client_begin()
+{
+    atomic_fetch_add(&hn_client_active, 1);
+}
+
+static void hn_client_end()
+{
+    atomic_store(&hn_client_last_ms, hn_now_ms());
+    atomic_fetch_sub(&hn_client_active, 1);
+}
+
+/* Transfers for a cancelled tool call are aborted, and time out no later
+ * than the call does */
+static bool hn_call_cancelled()
 {
-    CURL* curl = NULL;
-    char* response = NULL;
+    return mcp_call_cancelled(NULL);
+}
 
+static long hn_call_remaining_ms()
+{
+    return mcp_call_remaining_ms(NULL);
+}
+
+static void hn_url(char* url, size_t size, const char* path)
+{
     while (path && *path == '/') path++;
+    snprintf(url, size, "%s/%s", HN_BASE_URL, path);
+}
+
+static cJSON* hn_get(const char* path)
+{
     char url[512];
-    snprintf(url, sizeof(url), "%s/%s", HN_BASE_URL, path);
+    hn_url(url, sizeof(url), path);
 
-    curl = curl_easy_init();
-    if (curl == NULL)
-        goto fail;
+    HttpRequest req = { .url = url };
+    hn_client_begin();
+    http_pool_get_json_many(hn_pool(), &req, 1, NULL, HN_TIMEOUT);
+    hn_client_end();
+    return req.json;
+}
 
-    response = strdup("");
-    if (response == NULL)
-        goto fail;
+/*
+ * Item cache
+ *
+ * Items are parsed once into a compact HnItem (a single allocation holding
+ * the struct, its strings and its kids) and shared by every tool. Old items
+ * are practically immutable, so the TTL grows with the age of the item.
+ *
+ * The cache is shared with the prefetch thread. The table is guarded by
+ * hn_item_cache_lock; items never change once cached and are refcounted, so
+ * they are read without the lock.
+ */
+
+#define HN_ITEM_CACHE_MAX 8192
+
+enum {
+    HN_ITEM_HAS_SCORE       = 1 << 0,
+    HN_ITEM_HAS_TIME        = 1 << 1,
+    HN_ITEM_HAS_PARENT      = 1 << 2,
+    HN_ITEM_HAS_DESCENDANTS = 1 << 3,
+};
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+typedef struct {
+    int id;
+    int flags;
+    atomic_int refcount;
+    int score;
+    int parent;
+    int descendants;
+    time_t time;
+    time_t expires;
+    const char* type;
+    const char* by;
+    const char* title;
+    const char* url;
+    const char* text;
+    int nkids;
+    int* kids;
+} HnItem;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-value"
+stb_declare_hash(STB_noprefix, HnItemCache, hn_item_cache_, int, HnItem*)
+stb_define_hash_vnull(HnItemCache, hn_item_cache_, int, INT_MIN, INT_MIN + 1,
+                      return stb_hash_number((unsigned int)k);,
+                      HnItem*, NULL)
+#pragma GCC diagnostic pop
+
+static HnItemCache* hn_item_cache = NULL;
+static pthread_mutex_t hn_item_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static HnItem* hn_item_from_json(cJSON* json)
+{
+    cJSON* id = cJSON_Select(json, ".id:n");
+    if (!id)
+        return NULL;
 
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
-        goto fail;
+    cJSON* strs[] = {
+        cJSON_Select(json, ".type:s"),
+        cJSON_Select(json, ".by:s"),
+        cJSON_Select(json, ".title:s"),
+        cJSON_Select(json, ".url:s"),
+        cJSON_Select(json, ".text:s"),
+    };
 
-    cJSON* json = cJSON_Parse(response);
-    curl_easy_cleanup(curl);
-    free(response);
-    return json;
+    int nkids = 0;
+    cJSON* kid = NULL;
+    cJSON* kids = cJSON_Select(json, ".kids:a");
+    cJSON_ArrayForEach(kid, kids) {
+        if (cJSON_IsNumber(kid)) nkids++;
+    }
+
+    size_t size = sizeof(HnItem) + nkids * sizeof(int);
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        if (strs[i]) size += strlen(strs[i]->valuestring) + 1;
+    }
+
+    HnItem* item = calloc(1, size);
+    if (!item)
+        return NULL;
+
+    item->id = id->valueint;
+    item->nkids = 0;
+    item->kids = (int*)(item + 1);
+    cJSON_ArrayForEach(kid, kids) {
+        if (cJSON_IsNumber(kid)) item->kids[item->nkids++] = kid->valueint;
+    }
 
-fail:
-    if (curl) curl_easy_cleanup(curl);
-    if (response) free(response);
+    const char** dst[] = {
+        &item->type, &item->by, &item->title, &item->url, &item->text,
+    };
+    char* p = (char*)(item->kids + nkids);
+    for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        if (!strs[i]) continue;
+        size_t len = strlen(strs[i]->valuestring) + 1;
+        memcpy(p, strs[i]->valuestring, len);
+        *dst[i] = p;
+        p += len;
+    }
+
+    cJSON* score = cJSON_Select(json, ".score:n");
+    if (score) {
+        item->flags |= HN_ITEM_HAS_SCORE;
+        item->score = score->valueint;
+    }
+
+    cJSON* time = cJSON_Select(json, ".time:n");
+    if (time) {
+        item->flags |= HN_ITEM_HAS_TIME;
+        item->time = time->valuedouble;
+    }
+
+    cJSON* parent = cJSON_Select(json, ".parent:n");
+    if (parent) {
+        item->flags |= HN_ITEM_HAS_PARENT;
+        item->parent = parent->valueint;
+    }
+
+    cJSON* descendants = cJSON_Select(json, ".descendants:n");
+    if (descendants) {
+        item->flags |= HN_ITEM_HAS_DESCENDANTS;
+        item->descendants = descendants->valueint;
+    }
+
+    return item;
+}
+
+/* Fresh items still collect votes and replies; after a couple of weeks HN
+ * locks them, so they can stay cached for a long time. */
+static time_t hn_item_ttl(const HnItem* item, time_t now)
+{
+    time_t age = (item->flags & HN_ITEM_HAS_TIME) ? now - item->time : 0;
+    if (age < 2 * 3600) return 60;
+    if (age < 2 * 86400) return 10 * 60;
+    if (age < 14 * 86400) return 3600;
+    return 24 * 3600;
+}
+
+static void hn_item_release(HnItem* item)
+{
+    if (item && atomic_fetch_sub(&item->refcount, 1) == 1)
+        free(item);
+}
+
+static void hn_item_cache_evict(time_t now)
+{
+    int* expired = NULL;
+    int* others = NULL;
+    for (int i = 0; i < hn_item_cache->limit; i++) {
+        int k = hn_item_cache->table[i].k;
+        if (k == INT_MIN || k == INT_MIN + 1) continue;
+        if (hn_item_cache->table[i].v->expires <= now)
+            *stb_arr_add(expired) = k;
+        else
+            *stb_arr_add(others) = k;
+    }
+
+    /* Drop expired entries first, then arbitrary ones down to 3/4 full */
+    int keep = HN_ITEM_CACHE_MAX * 3 / 4;
+    int excess = hn_item_cache->count - stb_arr_len(expired) - keep;
+    for (int i = 0; i < excess && i < stb_arr_len(others); i++)
+        *stb_arr_add(expired) = others[i];
+
+    for (int i = 0; i < stb_arr_len(expired); i++) {
+        HnItem* item = NULL;
+        if (hn_item_cache_remove(hn_item_cache, expired[i], &item))
+            hn_item_release(item);
+    }
+
+    stb_arr_free(expired);
+    stb_arr_free(others);
+}
+
+/* Fill items[i] with a referenced item for each of the n ids, NULL if it
+ * could not be fetched. Release them with hn_item_release(). Ids missing from
+ * the cache are fetched concurrently on pool. */
+static void hn_items_fetch(HttpPool* pool, const int* ids, int n, HnItem** items)
+{
+    for (int i = 0; i < n; i++)
+        items[i] = NULL;
+
+    pthread_mutex_lock(&hn_item_cache_lock);
+    if (!hn_item_cache)
+        hn_item_cache = hn_item_cache_create();
+    if (!hn_item_cache) {
+        pthread_mutex_unlock(&hn_item_cache_lock);
+        return;
+    }
+
+    time_t now = time(NULL);
+    HttpRequest* reqs = NULL;
+    int* missing = NULL;
+    for (int i = 0; i < n; i++) {
+        HnItem* item = hn_item_cache_get(hn_item_cache, ids[i]);
+        if (item && item->expires > now) {
+            item->refcount++;
+            items[i] = item;
+            continue;
+        }
+
+        bool queued = false;
+        for (int k = 0; k < stb_arr_len(missing) && !queued; k++)
+            queued = missing[k] == ids[i];
+        if (queued)
+            continue;
+
+        char path[128];
+        char url[512];
+        snprintf(path, sizeof(path), "item/%d.json", ids[i]);
+        hn_url(url, sizeof(url), path);
+        HttpRequest* req = stb_arr_add(reqs);
+        req->url = strdup(url);
+        *stb_arr_add(missing) = ids[i];
+    }
+    pthread_mutex_unlock(&hn_item_cache_lock);
+
+    if (!reqs)
+        return;
+    http_pool_get_json_many(pool, reqs, stb_arr_len(reqs), NULL, HN_TIMEOUT);
+
+    pthread_mutex_lock(&hn_item_cache_lock);
+    for (int k = 0; k < stb_arr_len(reqs); k++) {
+        int id = missing[k];
+        HnItem* item = hn_item_cache_get(hn_item_cache, id);
+        HnItem* fresh = reqs[k].json ? hn_item_from_json(reqs[k].json) : NULL;
+        cJSON_Delete(reqs[k].json);
+        free((char*)reqs[k].url);
+
+        if (fresh) {
+            fresh->expires = now + hn_item_ttl(fresh, now);
+            fresh->refcount = 1; /* cache */
+
+            if (item) {
+                hn_item_cache_remove(hn_item_cache, id, NULL);
+                hn_item_release(item);
+            } else if (hn_item_cache->count >= HN_ITEM_CACHE_MAX) {
+                hn_item_cache_evict(now);
+            }
+            hn_item_cache_add(hn_item_cache, id, fresh);
+            item = fresh;
+        }
+
+        /* A stale copy is served rather than nothing */
+        for (int i = 0; i < n; i++) {
+            if (ids[i] == id && item && !items[i]) {
+                item->refcount++;
+                items[i] = item;
+            }
+        }
+    }
+    pthread_mutex_unlock(&hn_item_cache_lock);
+
+    stb_arr_free(reqs);
+    stb_arr_free(missing);
+}
+
+static void hn_items_get(const int* ids, int n, HnItem** items)
+{
+    hn_client_begin();
+    hn_items_fetch(hn_pool(), ids, n, items);
+    hn_client_end();
+}
+
+/* Returns a referenced item, release it with hn_item_release() */
+static HnItem* hn_item_get(int id)
+{
+    HnItem* item;
+    hn_items_get(&id, 1, &item);
+    return item;
+}
+
+static void hn_item_cache_cleanup()
+{
+    if (!hn_item_cache) return;
+    for (int i = 0; i < hn_item_cache->limit; i++) {
+        int k = hn_item_cache->table[i].k;
+        if (k == INT_MIN || k == INT_MIN + 1) continue;
+        hn_item_release(hn_item_cache->table[i].v);
+    }
+    hn_item_cache_destroy(hn_item_cache);
+    hn_item_cache = NULL;
+}
+
+/*
+ * Prefetch
+ *
+ * A story list is usually followed by get_item or get_comments on some of
+ * its stories. With HN_PREFETCH set, a background thread warms the item
+ * cache with the listed stories and their top-level comments, up to
+ * HN_PREFETCH items per list. It fetches a few items at a time, and only
+ * while no tool call has used the API for HN_PREFETCH_IDLE_MS. A newer list
+ * replaces the one being prefetched.
+ */
+
+#define HN_PREFETCH_PARALLEL 4
+#define HN_PREFETCH_IDLE_MS 250
+
+static int hn_prefetch_budget = 0;          /* items per list, 0 disables */
+static int* hn_prefetch_ids = NULL;         /* stb_arr, next list to warm */
+static bool hn_prefetch_stop = false;
+static bool hn_prefetch_running = false;
+static pthread_t hn_prefetch_thread;
+static pthread_mutex_t hn_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hn_prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+/* Wait for the client to go idle. Returns false if the current list should
+ * be dropped instead. Called with hn_prefetch_lock held. */
+static bool hn_prefetch_wait_idle()
+{
+    while (!hn_prefetch_stop && !hn_prefetch_ids) {
+        long long idle = hn_now_ms() - atomic_load(&hn_client_last_ms);
+        if (atomic_load(&hn_client_active) == 0 && idle >= HN_PREFETCH_IDLE_MS)
+            return true;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 50 * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&hn_prefetch_cond, &hn_prefetch_lock, &ts);
+    }
+    return false;
+}
+
+/* Fetch ids a chunk at a time while the client is idle. Kids of the fetched
+ * items are added to kids, if not NULL, within the budget. Returns false if
+ * the list was dropped. Called with hn_prefetch_lock held. */
+static bool hn_prefetch_items(HttpPool* pool, const int* ids, int n, int** kids, int* budget)
+{
+    for (int i = 0; i < n; i += HN_PREFETCH_PARALLEL) {
+        if (!hn_prefetch_wait_idle())
+            return false;
+
+        int chunk = n - i < HN_PREFETCH_PARALLEL ? n - i : HN_PREFETCH_PARALLEL;
+        HnItem* items[HN_PREFETCH_PARALLEL];
+        pthread_mutex_unlock(&hn_prefetch_lock);
+        hn_items_fetch(pool, ids + i, chunk, items);
+        pthread_mutex_lock(&hn_prefetch_lock);
+
+        for (int k = 0; k < chunk; k++) {
+            for (int j = 0; kids && items[k] && j < items[k]->nkids && *budget > 0; j++) {
+                *stb_arr_add(*kids) = items[k]->kids[j];
+                (*budget)--;
+            }
+            hn_item_release(items[k]);
+        }
+    }
+    return true;
+}
+
+static void* hn_prefetch_main(void* arg)
+{
+    (void)arg;
+    HttpPool* pool = http_pool_create(HN_PREFETCH_PARALLEL);
+
+    pthread_mutex_lock(&hn_prefetch_lock);
+    while (!hn_prefetch_stop) {
+        if (!hn_prefetch_ids) {
+            pthread_cond_wait(&hn_prefetch_cond, &hn_prefetch_lock);
+            continue;
+        }
+
+        int* stories = hn_prefetch_ids;
+        hn_prefetch_ids = NULL;
+        int* kids = NULL;
+
+        /* Stories first, they are cheap when the list call just fetched them */
+        int budget = hn_prefetch_budget - stb_arr_len(stories);
+        if (hn_prefetch_items(pool, stories, stb_arr_len(stories), &kids, &budget))
+            hn_prefetch_items(pool, kids, stb_arr_len(kids), NULL, &budget);
+
+        stb_arr_free(stories);
+        stb_arr_free(kids);
+    }
+    pthread_mutex_unlock(&hn_prefetch_lock);
+
+    http_pool_destroy(pool);
     return NULL;
 }
 
+/* Queue a story list for prefetching, replacing any list not done yet */
+static void hn_prefetch_stories(const int* ids, int n)
+{
+    if (!hn_prefetch_running || n <= 0)
+        return;
+
+    pthread_mutex_lock(&hn_prefetch_lock);
+    stb_arr_free(hn_prefetch_ids);
+    hn_prefetch_ids = NULL;
+    for (int i = 0; i < n && i < hn_prefetch_budget; i++)
+        *stb_arr_add(hn_prefetch_ids) = ids[i];
+    pthread_cond_signal(&hn_prefetch_cond);
+    pthread_mutex_unlock(&hn_prefetch_lock);
+}
+
+static void hn_prefetch_init()
+{
+    const char* budget = getenv("HN_PREFETCH");
+    hn_prefetch_budget = budget ? atoi(budget) : 0;
+    if (hn_prefetch_budget <= 0)
+        return;
+    hn_prefetch_running = pthread_create(&hn_prefetch_thread, NULL, hn_prefetch_main, NULL) == 0;
+}
+
+static void hn_prefetch_cleanup()
+{
+    if (!hn_prefetch_running)
+        return;
+
+    pthread_mutex_lock(&hn_prefetch_lock);
+    hn_prefetch_stop = true;
+    pthread_cond_signal(&hn_prefetch_cond);
+    pthread_mutex_unlock(&hn_prefetch_lock);
+    pthread_join(hn_prefetch_thread, NULL);
+
+    stb_arr_free(hn_prefetch_ids);
+    hn_prefetch_ids = NULL;
+    hn_prefetch_running = false;
+}
+
 static McpToolCallResult* fetch_stories(const char* endpoint, int limit)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
@@ -81,47 +540,40 @@ static McpToolCallResult* fetch_stories(const char* endpoint, int limit)
 
     sds result = sdsempty();
 
+    int* listed = NULL;
     int count = 0;
     cJSON* id_item = NULL;
     cJSON_ArrayForEach(id_item, ids_json) {
-        if (count >= limit) break;
+        if (count >= limit || mcp_call_cancelled(NULL)) break;
         if (!cJSON_IsNumber(id_item)) continue;
 
-        int story_id = id_item->valueint;
-        char path[128];
-        snprintf(path, sizeof(path), "item/%d.json", story_id);
-
-        cJSON* story_json = hn_get(path);
-        if (!story_json) continue;
-
-        cJSON* id = cJSON_Select(story_json, ".id:n");
-        cJSON* title = cJSON_Select(story_json, ".title:s");
-        cJSON* by = cJSON_Select(story_json, ".by:s");
-        cJSON* score = cJSON_Select(story_json, ".score:n");
-        cJSON* url = cJSON_Select(story_json, ".url:s");
-        cJSON* time = cJSON_Select(story_json, ".time:n");
-
-        if (id && title) {
-            result = sdscatprintf(result, "#%d: %s\n", id->valueint, title->valuestring);
-            if (by)
-                result = sdscatprintf(result, "  Author: %s\n", by->valuestring);
-            if (score)
-                result = sdscatprintf(result, "  Score: %d points\n", score->valueint);
-            if (url)
-                result = sdscatprintf(result, "  URL: %s\n", url->valuestring);
-            if (time) {
-                time_t timestamp = time->valuedouble;
+        HnItem* story = hn_item_get(id_item->valueint);
+        if (!story) continue;
+
+        if (story->title) {
+            result = sdscatprintf(result, "#%d: %s\n", story->id, story->title);
+            if (story->by)
+                result = sdscatprintf(result, "  Author: %s\n", story->by);
+            if (story->flags & HN_ITEM_HAS_SCORE)
+                result = sdscatprintf(result, "  Score: %d points\n", story->score);
+            if (story->url)
+                result = sdscatprintf(result, "  URL: %s\n", story->url);
+            if (story->flags & HN_ITEM_HAS_TIME) {
                 char time_str[64];
-                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&timestamp));
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&story->time));
                 result = sdscatprintf(result, "  Time: %s UTC\n", time_str);
             }
             result = sdscat(result, "\n");
+            *stb_arr_add(listed) = story->id;
             count++;
         }
 
-        cJSON_Delete(story_json);
+        hn_item_release(story);
     }
 
+    hn_prefetch_stories(listed, stb_arr_len(listed));
+    stb_arr_free(listed);
+
     if (count == 0) {
         result = sdscat(result, "No stories found\n");
     }
@@ -240,6 +692,102 @@ static McpTool tool_get_updates = {
     },
 };
 
+static sds format_item(sds result, const HnItem* item)
+{
+    result = sdscatprintf(result, "#%d", item->id);
+
+    if (item->title) {
+        result = sdscatprintf(result, ": %s\n", item->title);
+    } else {
+        result = sdscat(result, "\n");
+    }
+
+    if (item->type)
+        result = sdscatprintf(result, "  Type: %s\n", item->type);
+    if (item->by)
+        result = sdscatprintf(result, "  Author: %s\n", item->by);
+    if (item->flags & HN_ITEM_HAS_SCORE)
+        result = sdscatprintf(result, "  Score: %d points\n", item->score);
+    if (item->url)
+        result = sdscatprintf(result, "  URL: %s\n", item->url);
+    if (item->flags & HN_ITEM_HAS_DESCENDANTS)
+        result = sdscatprintf(result, "  Comments: %d\n", item->descendants);
+    if (item->flags & HN_ITEM_HAS_PARENT)
+        result = sdscatprintf(result, "  Parent: #%d\n", item->parent);
+    if (item->flags & HN_ITEM_HAS_TIME) {
+        char time_str[64];
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&item->time));
+        result = sdscatprintf(result, "  Time: %s UTC\n", time_str);
+    }
+    if (item->text) {
+        result = sdscat(result, "\n  Text:\n");
+        result = sdscatprintf(result, "  %s\n", item->text);
+    }
+
+    return result;
+}
+
+/* Structured form of an item, the shape of hn_item_output_schema */
+static cJSON* hn_item_marshal(const HnItem* item)
+{
+    cJSON* json = cJSON_CreateObject();
+    if (!json)
+        return NULL;
+
+    cJSON_AddNumberToObject(json, "id", item->id);
+    if (item->type)
+        cJSON_AddStringToObject(json, "type", item->type);
+    if (item->by)
+        cJSON_AddStringToObject(json, "by", item->by);
+    if (item->title)
+        cJSON_AddStringToObject(json, "title", item->title);
+    if (item->url)
+        cJSON_AddStringToObject(json, "url", item->url);
+    if (item->text)
+        cJSON_AddStringToObject(json, "text", item->text);
+    if (item->flags & HN_ITEM_HAS_SCORE)
+        cJSON_AddNumberToObject(json, "score", item->score);
+    if (item->flags & HN_ITEM_HAS_DESCENDANTS)
+        cJSON_AddNumberToObject(json, "descendants", item->descendants);
+    if (item->flags & HN_ITEM_HAS_PARENT)
+        cJSON_AddNumberToObject(json, "parent", item->parent);
+    if (item->flags & HN_ITEM_HAS_TIME)
+        cJSON_AddNumberToObject(json, "time", item->time);
+    if (item->nkids > 0)
+        cJSON_AddItemToObject(json, "kids", cJSON_CreateIntArray(item->kids, item->nkids));
+    return json;
+}
+
+static const char* hn_item_output_required[] = { "id", NULL };
+
+static McpInputSchema hn_item_output_props[] = {
+    { .name = "id", .type = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    { .name = "type", .description = "story, comment, job, poll or pollopt",
+      .type = MCP_INPUT_SCHEMA_TYPE_STRING },
+    { .name = "by", .description = "Author", .type = MCP_INPUT_SCHEMA_TYPE_STRING },
+    { .name = "title", .type = MCP_INPUT_SCHEMA_TYPE_STRING },
+    { .name = "url", .type = MCP_INPUT_SCHEMA_TYPE_STRING },
+    { .name = "text", .description = "HTML", .type = MCP_INPUT_SCHEMA_TYPE_STRING },
+    { .name = "score", .type = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    { .name = "descendants", .description = "Total comment count",
+      .type = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    { .name = "parent", .type = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    { .name = "time", .description = "Unix time",
+      .type = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    { .name = "kids", .description = "Direct replies, in ranked order",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .type_arr = MCP_INPUT_SCHEMA_TYPE_NUMBER },
+    mcp_input_schema_null
+};
+
+static McpInputSchema hn_item_output_schema[] = {
+    { .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+      .properties = hn_item_output_props,
+      .required = hn_item_output_required,
+    },
+    mcp_input_schema_null
+};
+
 static McpToolCallResult* get_item_handler(cJSON* params)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
@@ -253,66 +801,20 @@ static McpToolCallResult* get_item_handler(cJSON* params)
         return r;
     }
 
-    int id = id_json->valueint;
-    char path[128];
-    snprintf(path, sizeof(path), "item/%d.json", id);
-
-    cJSON* json = hn_get(path);
-    if (!json) {
+    HnItem* item = hn_item_get(id_json->valueint);
+    if (!item) {
         mcp_tool_call_result_set_error(r);
         mcp_tool_call_result_add_text(r, "Failed to fetch item from HackerNews");
         return r;
     }
 
-    sds result = sdsempty();
-
-    cJSON* id_field = cJSON_Select(json, ".id:n");
-    cJSON* type = cJSON_Select(json, ".type:s");
-    cJSON* by = cJSON_Select(json, ".by:s");
-    cJSON* time = cJSON_Select(json, ".time:n");
-    cJSON* score = cJSON_Select(json, ".score:n");
-    cJSON* title = cJSON_Select(json, ".title:s");
-    cJSON* url = cJSON_Select(json, ".url:s");
-    cJSON* text = cJSON_Select(json, ".text:s");
-    cJSON* parent = cJSON_Select(json, ".parent:n");
-    cJSON* descendants = cJSON_Select(json, ".descendants:n");
-
-    if (id_field)
-        result = sdscatprintf(result, "#%d", id_field->valueint);
-
-    if (title) {
-        result = sdscatprintf(result, ": %s\n", title->valuestring);
-    } else {
-        result = sdscat(result, "\n");
-    }
-
-    if (type)
-        result = sdscatprintf(result, "  Type: %s\n", type->valuestring);
-    if (by)
-        result = sdscatprintf(result, "  Author: %s\n", by->valuestring);
-    if (score)
-        result = sdscatprintf(result, "  Score: %d points\n", score->valueint);
-    if (url)
-        result = sdscatprintf(result, "  URL: %s\n", url->valuestring);
-    if (descendants)
-        result = sdscatprintf(result, "  Comments: %d\n", descendants->valueint);
-    if (parent)
-        result = sdscatprintf(result, "  Parent: #%d\n", parent->valueint);
-    if (time) {
-        time_t timestamp = time->valuedouble;
-        char time_str[64];
-        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&timestamp));
-        result = sdscatprintf(result, "  Time: %s UTC\n", time_str);
-    }
-    if (text) {
-        result = sdscat(result, "\n  Text:\n");
-        result = sdscatprintf(result, "  %s\n", text->valuestring);
+    mcp_tool_call_result_set_structured(r, hn_item_marshal(item));
+    if (mcp_call_wants_text(NULL)) {
+        sds result = format_item(sdsempty(), item);
+        mcp_tool_call_result_add_text(r, result);
+        sdsfree(result);
     }
-
-    cJSON_Delete(json);
-
-    mcp_tool_call_result_add_text(r, result);
-    sdsfree(result);
+    hn_item_release(item);
     return r;
 }
 
@@ -332,36 +834,132 @@ static McpTool tool_get_item = {
         .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
         .properties = tool_get_item_schema,
     },
+    .output_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = hn_item_output_props,
+        .required = hn_item_output_required,
+    },
 };
 
-static McpToolCallResult* get_user_handler(cJSON* params)
+static McpToolCallResult* get_items_handler(cJSON* params)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
     if (!r)
         return NULL;
 
-    cJSON* id_json = cJSON_Select(params, ".id:s");
-    if (!id_json) {
+    cJSON* ids_json = cJSON_Select(params, ".ids:a");
+    if (!ids_json) {
         mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "id parameter is required");
+        mcp_tool_call_result_add_text(r, "ids parameter is required");
         return r;
     }
 
-    const char* id = id_json->valuestring;
-    char* id_escaped = curl_easy_escape(NULL, id, 0);
-    char path[256];
-    snprintf(path, sizeof(path), "user/%s.json", id_escaped);
-    curl_free(id_escaped);
+    int* ids = NULL;
+    cJSON* id_json = NULL;
+    cJSON_ArrayForEach(id_json, ids_json) {
+        if (cJSON_IsNumber(id_json))
+            *stb_arr_add(ids) = id_json->valueint;
+    }
 
-    cJSON* json = hn_get(path);
-    if (!json) {
+    int n = stb_arr_len(ids);
+    if (n == 0 || n > HN_BATCH_MAX) {
+        stb_arr_free(ids);
         mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to fetch user from HackerNews");
+        mcp_tool_call_result_add_textf(r, "ids must contain between 1 and %d item ids", HN_BATCH_MAX);
         return r;
     }
 
+    /* Repeated ids are fetched once and listed once */
+    HnItem** items = calloc(n, sizeof(HnItem*));
+    if (!items) {
+        stb_arr_free(ids);
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Out of memory");
+        return r;
+    }
+    hn_items_get(ids, n, items);
+
+    bool text = mcp_call_wants_text(NULL);
+    cJSON* structured = cJSON_CreateObject();
+    cJSON* found = cJSON_AddArrayToObject(structured, "items");
+    cJSON* missing = cJSON_AddArrayToObject(structured, "missing");
     sds result = sdsempty();
+    for (int i = 0; i < n; i++) {
+        bool seen = false;
+        for (int k = 0; k < i && !seen; k++)
+            seen = ids[k] == ids[i];
+        if (seen)
+            continue;
+
+        if (items[i])
+            cJSON_AddItemToArray(found, hn_item_marshal(items[i]));
+        else
+            cJSON_AddItemToArray(missing, cJSON_CreateNumber(ids[i]));
+        if (!text)
+            continue;
+
+        if (sdslen(result) > 0)
+            result = sdscat(result, "\n");
+        if (items[i])
+            result = format_item(result, items[i]);
+        else
+            result = sdscatprintf(result, "#%d\n  Failed to fetch item from HackerNews\n", ids[i]);
+    }
+
+    for (int i = 0; i < n; i++)
+        hn_item_release(items[i]);
+    free(items);
+    stb_arr_free(ids);
+
+    mcp_tool_call_result_set_structured(r, structured);
+    if (text)
+        mcp_tool_call_result_add_text(r, result);
+    sdsfree(result);
+    return r;
+}
+
+static McpInputSchema tool_get_items_schema[] = {
+    { .name = "ids",
+      .description = "Item IDs to fetch, at most 500",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .type_arr = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+    },
+    mcp_input_schema_null
+};
+
+static const char* tool_get_items_output_required[] = { "items", "missing", NULL };
+
+static McpInputSchema tool_get_items_output[] = {
+    { .name = "items",
+      .description = "Items found, repeated ids once",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .properties = hn_item_output_schema,
+    },
+    { .name = "missing",
+      .description = "IDs that could not be fetched",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .type_arr = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+    },
+    mcp_input_schema_null
+};
 
+static McpTool tool_get_items = {
+    .name = "get_items",
+    .description = "Get several HackerNews items by ID in one call",
+    .handler = get_items_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_get_items_schema,
+    },
+    .output_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_get_items_output,
+        .required = tool_get_items_output_required,
+    },
+};
+
+static sds format_user(sds result, cJSON* json)
+{
     cJSON* id_field = cJSON_Select(json, ".id:s");
     cJSON* karma = cJSON_Select(json, ".karma:n");
     cJSON* created = cJSON_Select(json, ".created:n");
@@ -387,6 +985,37 @@ static McpToolCallResult* get_user_handler(cJSON* params)
         result = sdscatprintf(result, "  %s\n", about->valuestring);
     }
 
+    return result;
+}
+
+static McpToolCallResult* get_user_handler(cJSON* params)
+{
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    if (!r)
+        return NULL;
+
+    cJSON* id_json = cJSON_Select(params, ".id:s");
+    if (!id_json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "id parameter is required");
+        return r;
+    }
+
+    const char* id = id_json->valuestring;
+    char* id_escaped = curl_easy_escape(NULL, id, 0);
+    char path[256];
+    snprintf(path, sizeof(path), "user/%s.json", id_escaped);
+    curl_free(id_escaped);
+
+    cJSON* json = hn_get(path);
+    if (!json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Failed to fetch user from HackerNews");
+        return r;
+    }
+
+    sds result = format_user(sdsempty(), json);
+
     cJSON_Delete(json);
 
     mcp_tool_call_result_add_text(r, result);
@@ -412,6 +1041,97 @@ static McpTool tool_get_user = {
     },
 };
 
+static McpToolCallResult* get_users_handler(cJSON* params)
+{
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    if (!r)
+        return NULL;
+
+    cJSON* ids_json = cJSON_Select(params, ".ids:a");
+    if (!ids_json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "ids parameter is required");
+        return r;
+    }
+
+    /* Unique ids in the order given */
+    const char** ids = NULL;
+    cJSON* id_json = NULL;
+    cJSON_ArrayForEach(id_json, ids_json) {
+        if (!cJSON_IsString(id_json))
+            continue;
+        bool seen = false;
+        for (int k = 0; k < stb_arr_len(ids) && !seen; k++)
+            seen = strcmp(ids[k], id_json->valuestring) == 0;
+        if (!seen)
+            *stb_arr_add(ids) = id_json->valuestring;
+    }
+
+    int n = stb_arr_len(ids);
+    if (n == 0 || n > HN_BATCH_MAX) {
+        stb_arr_free(ids);
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_textf(r, "ids must contain between 1 and %d user ids", HN_BATCH_MAX);
+        return r;
+    }
+
+    HttpRequest* reqs = calloc(n, sizeof(HttpRequest));
+    if (!reqs) {
+        stb_arr_free(ids);
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Out of memory");
+        return r;
+    }
+    for (int i = 0; i < n; i++) {
+        char* id_escaped = curl_easy_escape(NULL, ids[i], 0);
+        char path[256];
+        char url[512];
+        snprintf(path, sizeof(path), "user/%s.json", id_escaped);
+        curl_free(id_escaped);
+        hn_url(url, sizeof(url), path);
+        reqs[i].url = strdup(url);
+    }
+
+    http_pool_get_json_many(hn_pool(), reqs, n, NULL, HN_TIMEOUT);
+
+    sds result = sdsempty();
+    for (int i = 0; i < n; i++) {
+        if (i > 0)
+            result = sdscat(result, "\n");
+        if (reqs[i].json)
+            result = format_user(result, reqs[i].json);
+        else
+            result = sdscatprintf(result, "User: %s\n  Failed to fetch user from HackerNews\n", ids[i]);
+        cJSON_Delete(reqs[i].json);
+        free((char*)reqs[i].url);
+    }
+    free(reqs);
+    stb_arr_free(ids);
+
+    mcp_tool_call_result_add_text(r, result);
+    sdsfree(result);
+    return r;
+}
+
+static McpInputSchema tool_get_users_schema[] = {
+    { .name = "ids",
+      .description = "User IDs to fetch, at most 500",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .type_arr = MCP_INPUT_SCHEMA_TYPE_STRING,
+    },
+    mcp_input_schema_null
+};
+
+static McpTool tool_get_users = {
+    .name = "get_users",
+    .description = "Get several HackerNews user profiles by ID in one call",
+    .handler = get_users_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_get_users_schema,
+    },
+};
+
 static McpToolCallResult* get_top_stories_handler(cJSON* params)
 {
     int limit = 20;
@@ -569,37 +1289,30 @@ static void format_comment_prefix(int* indices, int depth, sds* prefix)
     }
 }
 
-static void append_comment_recursive(cJSON* item, int depth, int max_depth,
+static void append_comment_recursive(const HnItem* item, int depth, int max_depth,
                                      int* indices, sds* result,
                                      int* count, int* total_fetched)
 {
-    cJSON* by = cJSON_Select(item, ".by:s");
-    cJSON* text = cJSON_Select(item, ".text:s");
-    cJSON* time = cJSON_Select(item, ".time:n");
-    cJSON* kids = cJSON_Select(item, ".kids:a");
-
     sds prefix = sdsempty();
     format_comment_prefix(indices, depth, &prefix);
 
-    const char* author = by ? by->valuestring : "[deleted]";
+    const char* author = item->by ? item->by : "[deleted]";
     *result = sdscatprintf(*result, "%s %s", prefix, author);
 
-    cJSON* score = cJSON_Select(item, ".score:n");
-    if (score) {
-        *result = sdscatprintf(*result, " (%d points)", score->valueint);
+    if (item->flags & HN_ITEM_HAS_SCORE) {
+        *result = sdscatprintf(*result, " (%d points)", item->score);
     }
     *result = sdscat(*result, "\n");
 
-    if (time) {
-        time_t timestamp = time->valuedouble;
+    if (item->flags & HN_ITEM_HAS_TIME) {
         char time_str[64];
-        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&timestamp));
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", gmtime(&item->time));
         *result = sdscatprintf(*result, "    %s UTC\n", time_str);
     }
 
-    if (text) {
+    if (item->text) {
         *result = sdscat(*result, "    ");
-        const char* p = text->valuestring;
+        const char* p = item->text;
         while (*p) {
             if (*p == '\n') {
                 *result = sdscat(*result, "\n    ");
@@ -615,24 +1328,18 @@ static void append_comment_recursive(cJSON* item, int depth, int max_depth,
     sdsfree(prefix);
     (*count)++;
 
-    if (kids && depth < max_depth - 1) {
+    if (depth < max_depth - 1) {
         int reply_count = 0;
-        cJSON* kid = NULL;
-        cJSON_ArrayForEach(kid, kids) {
-            if (!cJSON_IsNumber(kid)) continue;
-            if (reply_count >= 10) break;
-
-            int kid_id = kid->valueint;
-            char path[128];
-            snprintf(path, sizeof(path), "item/%d.json", kid_id);
+        for (int i = 0; i < item->nkids; i++) {
+            if (reply_count >= 10 || mcp_call_cancelled(NULL)) break;
 
-            cJSON* kid_json = hn_get(path);
-            if (!kid_json) continue;
+            HnItem* kid = hn_item_get(item->kids[i]);
+            if (!kid) continue;
 
             indices[depth + 1] = reply_count + 1;
-            append_comment_recursive(kid_json, depth + 1, max_depth,
+            append_comment_recursive(kid, depth + 1, max_depth,
                                     indices, result, count, total_fetched);
-            cJSON_Delete(kid_json);
+            hn_item_release(kid);
             reply_count++;
         }
     }
@@ -669,11 +1376,8 @@ static McpToolCallResult* get_comments_handler(cJSON* params)
         if (limit > 100) limit = 100;
     }
 
-    char path[128];
-    snprintf(path, sizeof(path), "item/%d.json", story_id);
-
-    cJSON* story_json = hn_get(path);
-    if (!story_json) {
+    HnItem* story = hn_item_get(story_id);
+    if (!story) {
         mcp_tool_call_result_set_error(r);
         mcp_tool_call_result_add_text(r, "Failed to fetch story from HackerNews");
         return r;
@@ -681,18 +1385,16 @@ static McpToolCallResult* get_comments_handler(cJSON* params)
 
     sds result = sdsempty();
 
-    cJSON* title = cJSON_Select(story_json, ".title:s");
-    if (title) {
+    if (story->title) {
         result = sdscatprintf(result, "Comments for Story #%d: %s\n\n",
-                              story_id, title->valuestring);
+                              story_id, story->title);
     } else {
         result = sdscatprintf(result, "Comments for Story #%d\n\n", story_id);
     }
 
-    cJSON* kids = cJSON_Select(story_json, ".kids:a");
-    if (!kids || cJSON_GetArraySize(kids) == 0) {
+    if (story->nkids == 0) {
         result = sdscat(result, "No comments\n");
-        cJSON_Delete(story_json);
+        hn_item_release(story);
         mcp_tool_call_result_add_text(r, result);
         sdsfree(result);
         return r;
@@ -703,26 +1405,35 @@ static McpToolCallResult* get_comments_handler(cJSON* params)
     int total_fetched = 0;
     int kid_count = 0;
 
-    cJSON* kid = NULL;
-    cJSON_ArrayForEach(kid, kids) {
-        if (kid_count >= limit) break;
-        if (!cJSON_IsNumber(kid)) continue;
+    /* Each finished thread is sent ahead as progress if the client asked
+     * for it, the full text still comes with the result */
+    bool partial = mcp_call_wants_progress(NULL);
+    size_t flushed = 0;
+    int threads = story->nkids < limit ? story->nkids : limit;
 
-        int kid_id = kid->valueint;
-        char kid_path[128];
-        snprintf(kid_path, sizeof(kid_path), "item/%d.json", kid_id);
+    for (int i = 0; i < story->nkids; i++) {
+        if (kid_count >= limit || mcp_call_cancelled(NULL)) break;
 
-        cJSON* kid_json = hn_get(kid_path);
-        if (!kid_json) continue;
+        HnItem* kid = hn_item_get(story->kids[i]);
+        if (!kid) continue;
 
         indices[0] = kid_count + 1;
-        append_comment_recursive(kid_json, 0, max_depth, indices,
+        append_comment_recursive(kid, 0, max_depth, indices,
                                 &result, &count, &total_fetched);
-        cJSON_Delete(kid_json);
+        hn_item_release(kid);
         kid_count++;
+
+        if (partial) {
+            McpToolCallResult* p = mcp_tool_call_result_create();
+            if (p && mcp_tool_call_result_add_text(p, result + flushed)) {
+                mcp_call_progress_content(NULL, kid_count, threads, p);
+                flushed = sdslen(result);
+            }
+            mcp_tool_call_result_delete(p);
+        }
     }
 
-    int total_comments = cJSON_GetArraySize(kids);
+    int total_comments = story->nkids;
     if (total_comments > limit) {
         result = sdscatprintf(result, "(%d comments displayed, %d total)\n",
                               count, total_comments);
@@ -730,7 +1441,7 @@ static McpToolCallResult* get_comments_handler(cJSON* params)
         result = sdscatprintf(result, "(%d comments)\n", count);
     }
 
-    cJSON_Delete(story_json);
+    hn_item_release(story);
 
     mcp_tool_call_result_add_text(r, result);
     sdsfree(result);
@@ -766,13 +1477,21 @@ static McpTool tool_get_comments = {
 int main(int argc, const char* argv[])
 {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    pthread_key_create(&hn_pool_key, hn_pool_free);
+    http_set_abort_check(hn_call_cancelled);
+    http_set_time_budget(hn_call_remaining_ms);
+    hn_prefetch_init();
 
     mcp_set_name("hackernews-mcp");
+    mcp_set_default_timeout(HN_TOOL_TIMEOUT);
+    mcp_set_batch_parallel(HN_BATCH_PARALLEL);
     mcp_set_version("1.0.0");
     mcp_add_tool(&tool_get_max_item);
     mcp_add_tool(&tool_get_updates);
     mcp_add_tool(&tool_get_item);
+    mcp_add_tool(&tool_get_items);
     mcp_add_tool(&tool_get_user);
+    mcp_add_tool(&tool_get_users);
     mcp_add_tool(&tool_get_top_stories);
     mcp_add_tool(&tool_get_new_stories);
     mcp_add_tool(&tool_get_best_stories);
@@ -784,6 +1503,9 @@ int main(int argc, const char* argv[])
     fprintf(stderr, "HackerNews MCP Server running...\n");
     mcp_main(argc, argv);
 
+    hn_prefetch_cleanup();
+    hn_item_cache_cleanup();
+    http_pool_destroy(pthread_getspecific(hn_pool_key));
     curl_global_cleanup();
     return 0;
 }
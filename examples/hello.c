@@ -1,34 +1,29 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "libmcp.h"
 #include "cJSON.h"
 
+/* a and b are required numbers in the schema, so they are there */
 static McpToolCallResult* add_handler(cJSON* params)
 {
+    (void)params;
     McpToolCallResult* r = mcp_tool_call_result_create();
-    cJSON* a = cJSON_GetObjectItem(params, "a:n");
-    cJSON* b = cJSON_GetObjectItem(params, "b:n");
-    if (!a || !b) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_textf(r, "invalid params");
-        return r;
-    }
-    mcp_tool_call_result_add_textf(r, "%d", a->valueint + b->valueint);
+    cJSON* a = mcp_call_arg(NULL, 0);
+    cJSON* b = mcp_call_arg(NULL, 1);
+    mcp_tool_call_result_add_textf(r, "%g", a->valuedouble + b->valuedouble);
     return r;
 }
 
 static McpToolCallResult* multiply_handler(cJSON* params)
 {
+    (void)params;
     McpToolCallResult* r = mcp_tool_call_result_create();
-    cJSON* a = cJSON_GetObjectItem(params, "a:n");
-    cJSON* b = cJSON_GetObjectItem(params, "b:n");
-    if (!a || !b) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_textf(r, "invalid params");
-        return r;
-    }
-    mcp_tool_call_result_add_textf(r, "%d", a->valueint + b->valueint);
+    cJSON* a = mcp_call_arg(NULL, 0);
+    cJSON* b = mcp_call_arg(NULL, 1);
+    mcp_tool_call_result_add_textf(r, "%g", a->valuedouble * b->valuedouble);
     return r;
 }
 
@@ -40,6 +35,75 @@ static McpToolCallResult* weather_handler(cJSON* params)
     return r;
 }
 
+/* Blocks the dispatcher and ignores cancellation; the timeout still
+ * answers the call while it runs */
+static McpToolCallResult* sleep_handler(cJSON* params)
+{
+    (void)params;
+    cJSON* ms = mcp_call_arg(NULL, 0);
+    struct timespec ts = { ms->valueint / 1000, (ms->valueint % 1000) * 1000000L };
+    if (ms->valueint > 0)
+        nanosleep(&ts, NULL);
+
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    mcp_tool_call_result_add_textf(r, "slept %d ms", ms->valueint);
+    return r;
+}
+
+typedef struct {
+    McpCallCtx* ctx;
+    int ms;
+} WaitCall;
+
+static void* wait_main(void* arg)
+{
+    WaitCall* call = arg;
+    struct timespec tick = { 0, 10 * 1000000L };
+    for (int waited = 0; waited < call->ms; waited += 10) {
+        /* Nobody is waiting for the answer anymore */
+        if (mcp_call_cancelled(call->ctx)) {
+            mcp_call_complete(call->ctx, NULL);
+            free(call);
+            return NULL;
+        }
+        nanosleep(&tick, NULL);
+    }
+
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    mcp_tool_call_result_add_textf(r, "waited %d ms", call->ms);
+    mcp_call_complete(call->ctx, r);
+    free(call);
+    return NULL;
+}
+
+/* Answers from another thread, later requests are served meanwhile */
+static void wait_handler(McpCallCtx* ctx, cJSON* params)
+{
+    (void)params;
+    cJSON* ms = mcp_call_arg(ctx, 0);
+    if (ms->valueint < 0) {
+        McpToolCallResult* r = mcp_tool_call_result_create();
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "invalid params");
+        mcp_call_complete(ctx, r);
+        return;
+    }
+
+    WaitCall* call = malloc(sizeof(*call));
+    call->ctx = ctx;
+    call->ms = ms->valueint;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, wait_main, call) != 0) {
+        free(call);
+        mcp_call_complete(ctx, NULL);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static const char* tool_ab_required[] = { "a", "b", NULL };
+
 static McpInputSchema tool_add_schema[] = {
     { .name = "a",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
@@ -57,6 +121,7 @@ static McpTool tool_add = {
     .input_schema = {
         .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
         .properties = tool_add_schema,
+        .required = tool_ab_required,
     },
 };
 
@@ -77,6 +142,7 @@ static McpTool tool_multiply = {
     .input_schema = {
         .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
         .properties = tool_multiply_schema,
+        .required = tool_ab_required,
     },
 };
 
@@ -94,6 +160,40 @@ static McpTool tool_weather = {
     },
 };
 
+static McpInputSchema tool_wait_schema[] = {
+    { .name = "ms",
+      .description = "Milliseconds to wait",
+      .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+    },
+    mcp_input_schema_null
+};
+
+static const char* tool_wait_required[] = { "ms", NULL };
+
+static McpTool tool_wait = {
+    .name = "wait",
+    .description = "Reply after the given number of milliseconds, times out after 1000",
+    .async_handler = wait_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_wait_schema,
+        .required = tool_wait_required,
+    },
+    .timeout_ms = 1000,
+};
+
+static McpTool tool_sleep = {
+    .name = "sleep",
+    .description = "Reply after blocking for the given number of milliseconds, times out after 500",
+    .handler = sleep_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_wait_schema,
+        .required = tool_wait_required,
+    },
+    .timeout_ms = 500,
+};
+
 int main(int argc, const char* argv[])
 {
     mcp_set_name("libmcp-sample");
@@ -102,6 +202,8 @@ int main(int argc, const char* argv[])
     mcp_add_tool(&tool_add);
     mcp_add_tool(&tool_multiply);
     mcp_add_tool(&tool_weather);
+    mcp_add_tool(&tool_wait);
+    mcp_add_tool(&tool_sleep);
 
     fprintf(stderr, "MCP Example Server running...\n");
 
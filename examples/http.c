@@ -0,0 +1,394 @@
+/*
+ * Small libcurl helpers shared by the examples
+ *
+ * GETs are coalesced: while a transfer for a URL is in flight, any thread
+ * asking for the same URL with the same headers waits for it instead of
+ * starting its own. The parsed body is shared by everyone waiting; each gets
+ * a copy except the last one to let go, which takes the original.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http.h"
+#include "sds.h"
+
+static bool (*http_abort_check)(void) = NULL;
+
+/* Status of a transfer stopped by http_abort_check, never returned */
+#define HTTP_STATUS_ABORTED -1
+
+void http_set_abort_check(bool (*check)(void))
+{
+    http_abort_check = check;
+}
+
+static long (*http_time_budget)(void) = NULL;
+
+void http_set_time_budget(long (*budget)(void))
+{
+    http_time_budget = budget;
+}
+
+static void (*http_batch_progress)(int done, int n) = NULL;
+
+void http_set_batch_progress(void (*progress)(int done, int n))
+{
+    http_batch_progress = progress;
+}
+
+static int http_xferinfo_callback(void* userp, curl_off_t dltotal, curl_off_t dlnow,
+                                  curl_off_t ultotal, curl_off_t ulnow)
+{
+    (void)userp; (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+    return http_abort_check && http_abort_check() ? 1 : 0;
+}
+
+static size_t http_write_callback(void* contents, size_t size, size_t nmemb, void* userp)
+{
+    size_t realsize = size * nmemb;
+    sds* body = (sds*)userp;
+    *body = sdscatlen(*body, contents, realsize);
+    return realsize;
+}
+
+static CURL* http_easy_create(const char* url, struct curl_slist* headers,
+                              long timeout, sds* body)
+{
+    CURL* curl = curl_easy_init();
+    if (curl == NULL)
+        return NULL;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    if (headers)
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+    long budget = http_time_budget ? http_time_budget() : -1;
+    if (budget >= 0 && (timeout <= 0 || budget < timeout * 1000))
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, budget > 0 ? budget : 1L);
+    else if (timeout > 0)
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    if (http_abort_check) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, http_xferinfo_callback);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    }
+    return curl;
+}
+
+
+/*
+ * Request coalescing
+ */
+
+typedef struct HttpFlight {
+    sds key;            /* url and headers */
+    cJSON* json;
+    long status;
+    int refs;           /* requests waiting on this transfer */
+    bool done;
+    struct HttpFlight* next;
+} HttpFlight;
+
+/* Transfers in flight. Finished ones are unlinked, so a later GET of the
+ * same URL fetches it again. */
+static HttpFlight* http_flights = NULL;
+static pthread_mutex_t http_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_flight_cond = PTHREAD_COND_INITIALIZER;
+
+static sds http_flight_key(const char* url, struct curl_slist* headers)
+{
+    sds key = sdsnew(url);
+    for (struct curl_slist* h = headers; h; h = h->next)
+        key = sdscatfmt(key, "\n%s", h->data);
+    return key;
+}
+
+/* Attach to the transfer for url, or start one. *leader is set when the
+ * caller must fetch it and call http_flight_finish(). */
+static HttpFlight* http_flight_join(const char* url, struct curl_slist* headers, bool* leader)
+{
+    sds key = http_flight_key(url, headers);
+
+    pthread_mutex_lock(&http_flight_lock);
+    HttpFlight* f = http_flights;
+    while (f && strcmp(f->key, key) != 0)
+        f = f->next;
+
+    if (f) {
+        f->refs++;
+        sdsfree(key);
+        *leader = false;
+    } else {
+        f = calloc(1, sizeof(*f));
+        if (f) {
+            f->key = key;
+            f->refs = 1;
+            f->next = http_flights;
+            http_flights = f;
+        } else {
+            sdsfree(key);
+        }
+        *leader = true;
+    }
+    pthread_mutex_unlock(&http_flight_lock);
+    return f;
+}
+
+static void http_flight_finish(HttpFlight* f, cJSON* json, long status)
+{
+    pthread_mutex_lock(&http_flight_lock);
+    HttpFlight** p = &http_flights;
+    while (*p != f)
+        p = &(*p)->next;
+    *p = f->next;
+
+    f->json = json;
+    f->status = status;
+    f->done = true;
+    pthread_cond_broadcast(&http_flight_cond);
+    pthread_mutex_unlock(&http_flight_lock);
+}
+
+/* Wait for the transfer and drop the reference. Returns a body the caller
+ * owns. */
+static cJSON* http_flight_release(HttpFlight* f, long* status)
+{
+    pthread_mutex_lock(&http_flight_lock);
+    while (!f->done)
+        pthread_cond_wait(&http_flight_cond, &http_flight_lock);
+    /* Nobody can join a finished flight, so refs only goes down from here */
+    bool last = f->refs == 1;
+    pthread_mutex_unlock(&http_flight_lock);
+
+    if (status)
+        *status = f->status;
+    if (last) {
+        cJSON* json = f->json;
+        sdsfree(f->key);
+        free(f);
+        return json;
+    }
+
+    cJSON* json = f->json ? cJSON_Duplicate(f->json, true) : NULL;
+    pthread_mutex_lock(&http_flight_lock);
+    last = --f->refs == 0;
+    pthread_mutex_unlock(&http_flight_lock);
+    if (last) {
+        cJSON_Delete(f->json);
+        sdsfree(f->key);
+        free(f);
+    }
+    return json;
+}
+
+static cJSON* http_fetch_json(const char* url, struct curl_slist* headers,
+                              long timeout, long* status)
+{
+    *status = 0;
+    sds body = sdsempty();
+    CURL* curl = http_easy_create(url, headers, timeout, &body);
+    if (curl == NULL) {
+        sdsfree(body);
+        return NULL;
+    }
+
+    cJSON* json = NULL;
+    CURLcode res = curl_easy_perform(curl);
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+        json = cJSON_Parse(body);
+    } else if (res == CURLE_ABORTED_BY_CALLBACK) {
+        *status = HTTP_STATUS_ABORTED;
+    }
+
+    curl_easy_cleanup(curl);
+    sdsfree(body);
+    return json;
+}
+
+/* Take the flight's result. If its leader was aborted for a cancelled call
+ * and this caller is not being aborted too, fetch the URL again. */
+static cJSON* http_flight_result(HttpFlight* f, const char* url, struct curl_slist* headers,
+                                 long timeout, long* status)
+{
+    cJSON* json = http_flight_release(f, status);
+    if (*status == HTTP_STATUS_ABORTED && !(http_abort_check && http_abort_check()))
+        json = http_fetch_json(url, headers, timeout, status);
+    if (*status == HTTP_STATUS_ABORTED)
+        *status = 0;
+    return json;
+}
+
+cJSON* http_get_json(const char* url, struct curl_slist* headers, long timeout)
+{
+    bool leader;
+    HttpFlight* f = http_flight_join(url, headers, &leader);
+    if (f == NULL) {
+        long status;
+        return http_fetch_json(url, headers, timeout, &status);
+    }
+
+    if (leader) {
+        long status;
+        cJSON* json = http_fetch_json(url, headers, timeout, &status);
+        http_flight_finish(f, json, status);
+    }
+    long status;
+    return http_flight_result(f, url, headers, timeout, &status);
+}
+
+struct HttpPool {
+    CURLM* multi;
+    int max_parallel;
+};
+
+HttpPool* http_pool_create(int max_parallel)
+{
+    HttpPool* pool = malloc(sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    pool->multi = curl_multi_init();
+    if (pool->multi == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->max_parallel = max_parallel < 1 ? 1 : max_parallel;
+    return pool;
+}
+
+void http_pool_destroy(HttpPool* pool)
+{
+    if (pool == NULL)
+        return;
+    curl_multi_cleanup(pool->multi);
+    free(pool);
+}
+
+void http_pool_get_json_many(HttpPool* pool, HttpRequest* reqs, int n,
+                             struct curl_slist* headers, long timeout)
+{
+    if (n <= 0)
+        return;
+
+    /* Only the requests this call leads are transferred here, the others
+     * are waited for at the end. Finishing our own transfers before waiting
+     * keeps two batches that lead each other's URLs from deadlocking. */
+    HttpFlight** flights = calloc(n, sizeof(HttpFlight*));
+    bool* leads = calloc(n, sizeof(bool));
+    if (flights == NULL || leads == NULL) {
+        for (int i = 0; i < n; i++) {
+            reqs[i].json = http_fetch_json(reqs[i].url, headers, timeout, &reqs[i].status);
+            if (reqs[i].status == HTTP_STATUS_ABORTED)
+                reqs[i].status = 0;
+        }
+        free(flights);
+        free(leads);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        reqs[i].json = NULL;
+        reqs[i].status = 0;
+        flights[i] = http_flight_join(reqs[i].url, headers, &leads[i]);
+    }
+
+    sds* bodies = pool ? calloc(n, sizeof(sds)) : NULL;
+    if (bodies == NULL) {
+        /* Degrade to one at a time */
+        for (int i = 0; i < n; i++) {
+            if (!leads[i])
+                continue;
+            reqs[i].json = http_fetch_json(reqs[i].url, headers, timeout, &reqs[i].status);
+            if (flights[i])
+                http_flight_finish(flights[i], reqs[i].json, reqs[i].status);
+        }
+        goto wait;
+    }
+
+    CURLM* multi = pool->multi;
+    int next = 0;
+    int running = 0;
+    int active = 0;
+    int finished = 0;
+
+    do {
+        /* Keep up to max_parallel transfers in flight */
+        while (next < n && active < pool->max_parallel) {
+            if (!leads[next]) {
+                next++;
+                continue;
+            }
+            bodies[next] = sdsempty();
+            CURL* curl = http_easy_create(reqs[next].url, headers, timeout, &bodies[next]);
+            if (curl) {
+                curl_easy_setopt(curl, CURLOPT_PRIVATE, (char*)&reqs[next]);
+                curl_multi_add_handle(multi, curl);
+                active++;
+            } else if (flights[next]) {
+                http_flight_finish(flights[next], NULL, 0);
+            }
+            next++;
+        }
+
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            CURL* curl = msg->easy_handle;
+            HttpRequest* req = NULL;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&req);
+
+            if (msg->data.result == CURLE_OK) {
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &req->status);
+                req->json = cJSON_Parse(bodies[req - reqs]);
+            } else if (msg->data.result == CURLE_ABORTED_BY_CALLBACK) {
+                req->status = HTTP_STATUS_ABORTED;
+            }
+            if (flights[req - reqs])
+                http_flight_finish(flights[req - reqs], req->json, req->status);
+
+            curl_multi_remove_handle(multi, curl);
+            curl_easy_cleanup(curl);
+            active--;
+            if (http_batch_progress)
+                http_batch_progress(++finished, n);
+        }
+
+        /* Wake up often enough to notice an abort */
+        if (active > 0)
+            curl_multi_poll(multi, NULL, 0, http_abort_check ? 100 : 1000, NULL);
+    } while (active > 0 || next < n);
+
+    for (int i = 0; i < n; i++)
+        sdsfree(bodies[i]);
+    free(bodies);
+
+wait:
+    for (int i = 0; i < n; i++) {
+        if (flights[i])
+            reqs[i].json = http_flight_result(flights[i], reqs[i].url, headers, timeout, &reqs[i].status);
+        else if (reqs[i].status == HTTP_STATUS_ABORTED)
+            reqs[i].status = 0;
+    }
+    free(flights);
+    free(leads);
+    if (http_batch_progress)
+        http_batch_progress(n, n);
+}
+
+void http_get_json_many(HttpRequest* reqs, int n, struct curl_slist* headers,
+                        long timeout, int max_parallel)
+{
+    if (n <= 0)
+        return;
+
+    HttpPool* pool = http_pool_create(max_parallel);
+    http_pool_get_json_many(pool, reqs, n, headers, timeout);
+    http_pool_destroy(pool);
+}
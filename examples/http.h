@@ -0,0 +1,53 @@
+#ifndef EXAMPLES_HTTP_H
+#define EXAMPLES_HTTP_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+#include "cJSON.h"
+
+/* One GET of a batch, see http_get_json_many() */
+typedef struct HttpRequest {
+    const char* url;
+    cJSON* json;    /* parsed response body, NULL on failure */
+    long status;
+} HttpRequest;
+
+/* Transfers poll check while they run and abort once it returns true, e.g.
+ * when the tool call they serve was cancelled. It is called on the thread
+ * running the transfer. NULL, the default, disables it. */
+void http_set_abort_check(bool (*check)(void));
+
+/* Transfers started while budget() returns a value >= 0 time out after at
+ * most that many milliseconds, e.g. what is left of a tool call's deadline.
+ * Called on the thread starting the transfer. */
+void http_set_time_budget(long (*budget)(void));
+
+/* Called as the GETs of a batch complete with how many of the n are done,
+ * on the thread running the batch, e.g. to report a tool call's progress.
+ * NULL, the default, disables it. */
+void http_set_batch_progress(void (*progress)(int done, int n));
+
+/* GET url and parse the body as JSON. headers may be NULL, timeout is in
+ * seconds, 0 for none. Returns NULL on transfer or parse failure. A GET of a
+ * URL already being fetched with the same headers, by this or another
+ * thread, waits for that transfer and gets a copy of its body. */
+cJSON* http_get_json(const char* url, struct curl_slist* headers, long timeout);
+
+/* Run n GETs concurrently, at most max_parallel at a time, and fill in
+ * json/status of each request. */
+void http_get_json_many(HttpRequest* reqs, int n, struct curl_slist* headers,
+                        long timeout, int max_parallel);
+
+/* A curl multi handle kept across batches, so connections to the same host
+ * are reused. Not thread safe, use one pool per thread. */
+typedef struct HttpPool HttpPool;
+
+HttpPool* http_pool_create(int max_parallel);
+void http_pool_destroy(HttpPool* pool);
+
+/* Like http_get_json_many() on the pool's connections. A NULL pool fetches
+ * one at a time. */
+void http_pool_get_json_many(HttpPool* pool, HttpRequest* reqs, int n,
+                             struct curl_slist* headers, long timeout);
+
+#endif
@@ -1,13 +1,24 @@
 #define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <curl/curl.h>
 #include "libmcp.h"
 #include "cJSON.h"
 #include "stb.h"
 #include "sds.h"
+#include "http.h"
 
 static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp)
 {
@@ -23,49 +34,15 @@ static size_t write_callback(void* contents, size_t size, size_t nmemb, void* us
 }
 
 /*
- * Base64 encoding for binary attachment data
+ * Binary download support for attachments
  */
 
-static const char base64_table[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static char* base64_encode(const unsigned char* data, size_t input_length,
-                           size_t* output_length)
-{
-    *output_length = 4 * ((input_length + 2) / 3);
-    char* encoded = malloc(*output_length + 1);
-    if (!encoded) {
-        return NULL;
-    }
-
-    size_t i, j;
-    for (i = 0, j = 0; i < input_length;) {
-        uint32_t octet_a = i < input_length ? data[i++] : 0;
-        uint32_t octet_b = i < input_length ? data[i++] : 0;
-        uint32_t octet_c = i < input_length ? data[i++] : 0;
-        uint32_t triple = (octet_a << 16) | (octet_b << 8) | octet_c;
-
-        encoded[j++] = base64_table[(triple >> 18) & 0x3F];
-        encoded[j++] = base64_table[(triple >> 12) & 0x3F];
-        encoded[j++] = base64_table[(triple >> 6) & 0x3F];
-        encoded[j++] = base64_table[triple & 0x3F];
-    }
-
-    /* Add padding */
-    int mod = input_length % 3;
-    if (mod > 0) {
-        encoded[*output_length - 1] = '=';
-        if (mod == 1) {
-            encoded[*output_length - 2] = '=';
-        }
-    }
-    encoded[*output_length] = '\0';
-    return encoded;
-}
+/* Attachments bigger than this are spooled to disk instead of memory */
+#define REDMINE_SPOOL_SIZE (1024 * 1024)
 
-/*
- * Binary download support for attachments
- */
+/* Attachments bigger than this are returned as links, REDMINE_MAX_INLINE_SIZE
+ * overrides it */
+#define REDMINE_MAX_INLINE_SIZE (10 * 1024 * 1024)
 
 typedef struct {
     char* data;
@@ -87,58 +64,75 @@ static size_t write_binary_callback(void* contents, size_t size, size_t nmemb,
     return realsize;
 }
 
-static const char* redmine_base_url;
-static const char* redmine_api_key;
-static int redmine_user_id;
-
-static cJSON* redmine_get(const char* path)
+static size_t write_fd_callback(void* contents, size_t size, size_t nmemb,
+                                void* userp)
 {
-    CURL* curl = NULL;
-    struct curl_slist* headers = NULL;
-    char* response = NULL;
-
-    while (path && *path == '/') path++;
-    char url[512];
-    snprintf(url, sizeof(url), "%s/%s", redmine_base_url, path);
-
-    char auth_header[256];
-    snprintf(auth_header, sizeof(auth_header), "X-Redmine-API-Key: %s", redmine_api_key);
+    size_t realsize = size * nmemb;
+    int fd = *(int*)userp;
+    const char* p = contents;
+    size_t left = realsize;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += n;
+        left -= n;
+    }
+    return realsize;
+}
 
-    curl = curl_easy_init();
-    if (curl == NULL)
-        goto fail;
+/* Anonymous temporary file, gone as soon as it is closed */
+static int redmine_spool_open()
+{
+    const char* dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/redmine-mcp-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
 
-    headers = curl_slist_append(NULL, auth_header);
-    if (headers == NULL)
-        goto fail;
+/* Base64-encode attachment chunks as they arrive */
+static size_t write_base64_callback(void* contents, size_t size, size_t nmemb,
+                                    void* userp)
+{
+    size_t realsize = size * nmemb;
+    if (!mcp_base64_update((McpBase64*)userp, contents, realsize))
+        return 0;
+    return realsize;
+}
 
-    response = strdup("");
-    if (response == NULL)
-        goto fail;
+/* Upper bound on concurrent requests to the Redmine server */
+#define REDMINE_MAX_PARALLEL 8
+/* Seconds before a request to Redmine is given up */
+#define REDMINE_TIMEOUT 60L
+/* Default time a tool call may take, in milliseconds */
+#define REDMINE_TOOL_TIMEOUT (120 * 1000)
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+static const char* redmine_base_url;
+static const char* redmine_api_key;
+static atomic_int redmine_user_id;
 
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
-        goto fail;
+/* X-Redmine-API-Key header shared by all GETs */
+static struct curl_slist* redmine_auth_headers;
 
-    cJSON* json = cJSON_Parse(response);
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers);
-    free(response);
-    return json;
+static void redmine_url(char* url, size_t size, const char* path)
+{
+    while (path && *path == '/') path++;
+    snprintf(url, size, "%s/%s", redmine_base_url, path);
+}
 
-fail:
-    if (curl) curl_easy_cleanup(curl);
-    if (headers) curl_slist_free_all(headers);
-    if (response) free(response);
-    return NULL;
+static cJSON* redmine_get(const char* path)
+{
+    char url[512];
+    redmine_url(url, sizeof(url), path);
+    return http_get_json(url, redmine_auth_headers, REDMINE_TIMEOUT);
 }
 
-static cJSON* redmine_get_with_opts(const char* path, char** optlist, int optnum)
+static sds redmine_path_with_opts(const char* path, char** optlist, int optnum)
 {
     sds fullpath = sdsnew(path);
     if (optnum) fullpath = sdscatlen(fullpath, "?", 1);
@@ -150,17 +144,132 @@ static cJSON* redmine_get_with_opts(const char* path, char** optlist, int optnum
         fullpath = sdscat(fullpath,escaped);
         curl_free(escaped);
     }
-    cJSON* json = redmine_get(fullpath);
-    sdsfree(fullpath);
-    return json;
+    return fullpath;
+}
+
+/*
+ * Paged listing
+ *
+ * Redmine returns at most REDMINE_PAGE_SIZE items per request. Bigger
+ * requests fetch the first page, take total_count from it, then fetch the
+ * remaining pages concurrently. Items are passed to the callback in order.
+ */
+
+#define REDMINE_PAGE_SIZE 100
+
+typedef struct {
+    int total_count;    /* -1 if the server didn't say */
+    int offset;         /* offset reported by the first page, -1 if absent */
+    bool complete;      /* false if a later page failed, items stop there */
+} RedminePage;
+
+typedef void (*RedminePageItem)(cJSON* item, void* userp);
+
+static sds redmine_page_url(const char* path, int limit, int offset)
+{
+    char url[1024];
+    redmine_url(url, sizeof(url), path);
+    return sdscatprintf(sdsnew(url), "%slimit=%d&offset=%d",
+                        strchr(path, '?') ? "&" : "?", limit, offset);
+}
+
+/* Returns false if the first page could not be fetched or has no key array */
+static bool redmine_get_paged(const char* path, const char* key, int limit, int offset,
+                              RedminePage* page, RedminePageItem item_cb, void* userp)
+{
+    char selector[64];
+    snprintf(selector, sizeof(selector), ".%s:a", key);
+
+    int first = limit < REDMINE_PAGE_SIZE ? limit : REDMINE_PAGE_SIZE;
+    sds url = redmine_page_url(path, first, offset);
+    cJSON* json = http_get_json(url, redmine_auth_headers, REDMINE_TIMEOUT);
+    sdsfree(url);
+
+    cJSON* items = json ? cJSON_Select(json, selector) : NULL;
+    if (!items) {
+        cJSON_Delete(json);
+        return false;
+    }
+
+    cJSON* total_count = cJSON_Select(json, ".total_count:n");
+    cJSON* off = cJSON_Select(json, ".offset:n");
+    page->total_count = total_count ? total_count->valueint : -1;
+    page->offset = off ? off->valueint : -1;
+    page->complete = true;
+
+    int got = cJSON_GetArraySize(items);
+    cJSON* item = NULL;
+    cJSON_ArrayForEach(item, items)
+        item_cb(item, userp);
+    cJSON_Delete(json);
+
+    /* Work out what is left, bounded by what the server has */
+    int remaining = limit - first;
+    if (page->total_count >= 0 && page->total_count - offset - first < remaining)
+        remaining = page->total_count - offset - first;
+    if (got < first || remaining <= 0)
+        return true;
+
+    int npages = (remaining + REDMINE_PAGE_SIZE - 1) / REDMINE_PAGE_SIZE;
+    HttpRequest* reqs = calloc(npages, sizeof(HttpRequest));
+    if (!reqs) {
+        page->complete = false;
+        return true;
+    }
+
+    for (int i = 0; i < npages; i++) {
+        int n = remaining - i * REDMINE_PAGE_SIZE;
+        reqs[i].url = redmine_page_url(path, n < REDMINE_PAGE_SIZE ? n : REDMINE_PAGE_SIZE,
+                                       offset + first + i * REDMINE_PAGE_SIZE);
+    }
+
+    http_get_json_many(reqs, npages, redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    for (int i = 0; i < npages; i++) {
+        cJSON* items = reqs[i].json ? cJSON_Select(reqs[i].json, selector) : NULL;
+        if (!items)
+            page->complete = false;
+        if (page->complete) {
+            cJSON_ArrayForEach(item, items)
+                item_cb(item, userp);
+        }
+        cJSON_Delete(reqs[i].json);
+        sdsfree((sds)reqs[i].url);
+    }
+    free(reqs);
+    return true;
+}
+
+/* "Total" and "Offset" lines followed by the items, takes ownership of items */
+static sds format_page_header(const RedminePage* page, sds items)
+{
+    sds result = sdsempty();
+    if (page->total_count >= 0)
+        result = sdscatprintf(result, "Total: %d\n", page->total_count);
+    if (page->offset >= 0)
+        result = sdscatprintf(result, "Offset: %d\n", page->offset);
+    result = sdscat(result, "\n");
+    result = sdscatsds(result, items);
+    if (!page->complete)
+        result = sdscat(result, "(Failed to fetch further pages, results end here)\n");
+    sdsfree(items);
+    return result;
 }
 
-static cJSON* redmine_post(const char* path, const char* data)
+/* POST data as JSON. *status is the HTTP status, 0 if the request failed;
+ * the parsed body is returned when there is one. */
+/* *sent turns false when the request failed before it reached the server,
+ * *retry_after holds the seconds of a Retry-After header, 0 without one */
+static cJSON* redmine_post(const char* path, const char* data, long* status,
+                           bool* sent, long* retry_after)
 {
     CURL* curl = NULL;
     struct curl_slist* headers = NULL;
     char* response = NULL;
 
+    *status = 0;
+    *sent = false;
+    *retry_after = 0;
     while (path && *path == '/') path++;
     char url[512];
     snprintf(url, sizeof(url), "%s/%s", redmine_base_url, path);
@@ -187,10 +296,17 @@ static cJSON* redmine_post(const char* path, const char* data)
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
     curl_easy_setopt(curl, CURLOPT_POST, 1L);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, REDMINE_TIMEOUT);
 
     CURLcode res = curl_easy_perform(curl);
+    *sent = res != CURLE_COULDNT_RESOLVE_HOST && res != CURLE_COULDNT_RESOLVE_PROXY
+            && res != CURLE_COULDNT_CONNECT;
     if (res != CURLE_OK)
         goto fail;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+    curl_off_t wait = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &wait) == CURLE_OK)
+        *retry_after = wait;
 
     cJSON* json = cJSON_Parse(response);
     curl_easy_cleanup(curl);
@@ -205,11 +321,13 @@ fail:
     return NULL;
 }
 
-static BinaryBuffer* redmine_download_binary(const char* url)
+static bool redmine_download(const char* url,
+                             size_t (*write_cb)(void*, size_t, size_t, void*),
+                             void* userp)
 {
     CURL* curl = NULL;
     struct curl_slist* headers = NULL;
-    BinaryBuffer* buf = NULL;
+    bool ok = false;
 
     char auth_header[256];
     snprintf(auth_header, sizeof(auth_header), "X-Redmine-API-Key: %s",
@@ -217,44 +335,33 @@ static BinaryBuffer* redmine_download_binary(const char* url)
 
     curl = curl_easy_init();
     if (curl == NULL) {
-        goto fail;
+        goto out;
     }
 
     headers = curl_slist_append(NULL, auth_header);
     if (headers == NULL) {
-        goto fail;
-    }
-
-    buf = malloc(sizeof(BinaryBuffer));
-    if (buf == NULL) {
-        goto fail;
+        goto out;
     }
-    buf->data = NULL;
-    buf->size = 0;
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_binary_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buf);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, userp);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        goto fail;
-    }
-
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers);
-    return buf;
+    ok = curl_easy_perform(curl) == CURLE_OK;
 
-fail:
+out:
     if (curl) curl_easy_cleanup(curl);
     if (headers) curl_slist_free_all(headers);
-    if (buf) {
-        if (buf->data) free(buf->data);
-        free(buf);
-    }
-    return NULL;
+    return ok;
+}
+
+static double redmine_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
 }
 
 static void redmine_user_id_init()
@@ -272,31 +379,369 @@ static void redmine_user_id_init()
 }
 
 /*
- * Issues statuses
+ * Metadata store
+ *
+ * Issue statuses, trackers, projects, versions and time entry activities are
+ * kept as immutable snapshots: the records in server order for listing, an id
+ * index, and for projects an identifier index.
+ *
+ * Readers only load the current snapshot pointer and never wait once a
+ * collection has been loaded. A snapshot older than its collection's TTL is
+ * still served while the refresh thread loads a new one and swaps it in. The
+ * replaced snapshot is retired: freed once no tool call is in flight, so
+ * pointers taken during a tool call stay valid for the whole call.
  */
 
+/* Seconds before a collection is reloaded */
+#define REDMINE_ENUMERATION_TTL (60 * 60)
+#define REDMINE_PROJECT_TTL (10 * 60)
+/* Lowest TTL accepted from REDMINE_METADATA_TTL */
+#define REDMINE_METADATA_TTL_MIN 30
+/* Seconds before retrying a failed reload */
+#define REDMINE_METADATA_RETRY 30
+
+/* Records that are only an id and a name */
 typedef struct {
     int id;
     char* name;
-} IssueStatus;
+} NamedRecord;
 
-static IssueStatus* redmine_issue_statuses_instance = NULL;
+typedef NamedRecord IssueStatus;
+typedef NamedRecord Tracker;
+typedef NamedRecord TimeEntryActivity;
 
-static IssueStatus* redmine_issue_statuses_get()
+typedef struct {
+    int id;
+    char* name;
+    char* identifier;
+    char* description;
+} Project;
+
+typedef struct {
+    int id;
+    char* name;
+    int project_id;
+} Version;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-value"
+stb_declare_hash(STB_noprefix, MetaIndex, meta_index_, int, int)
+stb_define_hash_base(STB_noprefix, MetaIndex, STB_nofields, meta_index_, meta_index_, 0.85f,
+                     int, INT_MIN, INT_MIN + 1, STB_nocopy, STB_nodelete, STB_nosafe,
+                     STB_equal, STB_equal, return stb_hash_number((unsigned int)k);,
+                     int, STB_nullvalue, -1)
+#pragma GCC diagnostic pop
+
+typedef struct {
+    void* items;                    /* stb_arr of the collection's records */
+    MetaIndex* index;               /* id -> position in items */
+    stb_sdict* identifier_index;    /* identifier -> record, projects only */
+} MetaSnapshot;
+
+/* Cursor over a snapshot file, ok turns false on truncated input */
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok;
+} SnapshotReader;
+
+typedef struct {
+    const char* name;
+    int ttl;
+    size_t record_size;
+    bool (*load)(MetaSnapshot* s);  /* fills items, false on failure */
+    void (*free_items)(void* items);
+    void (*save)(sds* out, const void* items);
+    bool (*restore)(SnapshotReader* r, MetaSnapshot* s);
+
+    _Atomic(MetaSnapshot*) current;
+    _Atomic(time_t) refresh_at;
+    atomic_bool stale;              /* refresh requested */
+
+    pthread_mutex_t lock;           /* serializes loads */
+} MetaCollection;
+
+typedef struct {
+    MetaCollection statuses;
+    MetaCollection trackers;
+    MetaCollection projects;
+    MetaCollection versions;
+    MetaCollection activities;
+} RedmineMetadata;
+
+static RedmineMetadata redmine_metadata;
+
+static pthread_t redmine_refresh_thread;
+static bool redmine_refresh_running = false;
+static bool redmine_refresh_pending = false;
+static bool redmine_refresh_stop = false;
+static bool redmine_preload = true;
+/* Set by reloads; the refresh thread saves the snapshot once per pass */
+static atomic_bool redmine_snapshot_dirty;
+static pthread_mutex_t redmine_refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t redmine_refresh_cond = PTHREAD_COND_INITIALIZER;
+
+/* Data replaced while tool calls may still use it, freed by the last call
+ * to leave. Handlers run one at a time, so that is right after the current
+ * one returns. */
+typedef struct RedmineRetired {
+    void (*free)(void* owner, void* data);
+    void* owner;
+    void* data;
+    struct RedmineRetired* next;
+} RedmineRetired;
+
+static RedmineRetired* redmine_retired = NULL;
+static int redmine_calls_in_flight = 0;
+static pthread_mutex_t redmine_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void redmine_retired_free(RedmineRetired* r)
+{
+    while (r) {
+        RedmineRetired* next = r->next;
+        r->free(r->owner, r->data);
+        free(r);
+        r = next;
+    }
+}
+
+/* Free data now if no call is in flight, else once the last one leaves */
+static void redmine_retire(void (*fn)(void* owner, void* data), void* owner, void* data)
+{
+    if (!data)
+        return;
+
+    pthread_mutex_lock(&redmine_retired_lock);
+    if (redmine_calls_in_flight > 0) {
+        RedmineRetired* r = malloc(sizeof(*r));
+        if (r) {
+            r->free = fn;
+            r->owner = owner;
+            r->data = data;
+            r->next = redmine_retired;
+            redmine_retired = r;
+        }
+        /* Without memory, leaking beats freeing data a call may read */
+        pthread_mutex_unlock(&redmine_retired_lock);
+        return;
+    }
+    pthread_mutex_unlock(&redmine_retired_lock);
+    fn(owner, data);
+}
+
+static void redmine_call_enter()
+{
+    pthread_mutex_lock(&redmine_retired_lock);
+    redmine_calls_in_flight++;
+    pthread_mutex_unlock(&redmine_retired_lock);
+}
+
+static void redmine_call_leave()
+{
+    RedmineRetired* r = NULL;
+    pthread_mutex_lock(&redmine_retired_lock);
+    if (--redmine_calls_in_flight == 0) {
+        r = redmine_retired;
+        redmine_retired = NULL;
+    }
+    pthread_mutex_unlock(&redmine_retired_lock);
+    redmine_retired_free(r);
+}
+
+/* Index records by id. Every record type starts with its int id. */
+static MetaIndex* meta_index_build(const void* records, int n, size_t stride)
+{
+    MetaIndex* index = meta_index_create();
+    if (!index)
+        return NULL;
+    for (int i = 0; i < n; i++)
+        meta_index_set(index, *(const int*)((const char*)records + i * stride), i);
+    return index;
+}
+
+static int meta_index_find(MetaIndex* index, int id)
+{
+    return index ? meta_index_get(index, id) : -1;
+}
+
+static void meta_snapshot_free(MetaCollection* c, MetaSnapshot* s)
+{
+    if (!s) return;
+    c->free_items(s->items);
+    if (s->index)
+        meta_index_destroy(s->index);
+    if (s->identifier_index)
+        stb_sdict_delete(s->identifier_index);
+    free(s);
+}
+
+static void meta_snapshot_retired_free(void* c, void* s)
+{
+    meta_snapshot_free(c, s);
+}
+
+/* Load a new snapshot and swap it in. Called with c->lock held. */
+static MetaSnapshot* meta_reload(MetaCollection* c)
+{
+    double start = redmine_now_ms();
+    MetaSnapshot* s = calloc(1, sizeof(*s));
+    if (!s || !c->load(s)) {
+        meta_snapshot_free(c, s);
+        fprintf(stderr, "Failed to load %s\n", c->name);
+        atomic_store(&c->refresh_at, time(NULL) + REDMINE_METADATA_RETRY);
+        atomic_store(&c->stale, false);
+        return atomic_load(&c->current);
+    }
+    s->index = meta_index_build(s->items, stb_arr_len(s->items), c->record_size);
+
+    MetaSnapshot* old = atomic_exchange(&c->current, s);
+    redmine_retire(meta_snapshot_retired_free, c, old);
+    atomic_store(&c->refresh_at, time(NULL) + c->ttl);
+    atomic_store(&c->stale, false);
+
+    fprintf(stderr, "Loaded %d %s in %.0f ms\n",
+            stb_arr_len(s->items), c->name, redmine_now_ms() - start);
+    atomic_store(&redmine_snapshot_dirty, true);
+    return s;
+}
+
+static void redmine_refresh_wake()
+{
+    pthread_mutex_lock(&redmine_refresh_lock);
+    redmine_refresh_pending = true;
+    pthread_cond_signal(&redmine_refresh_cond);
+    pthread_mutex_unlock(&redmine_refresh_lock);
+}
+
+static MetaSnapshot* meta_get(MetaCollection* c)
+{
+    MetaSnapshot* s = atomic_load(&c->current);
+    if (s) {
+        /* Serve what we have, refresh in the background once it expired */
+        if (time(NULL) >= atomic_load(&c->refresh_at) && !atomic_exchange(&c->stale, true)) {
+            if (redmine_refresh_running)
+                redmine_refresh_wake();
+            else
+                atomic_store(&c->stale, false);
+        }
+        return s;
+    }
+
+    /* Nothing loaded yet: load now, or wait for the load in flight */
+    if (pthread_mutex_trylock(&c->lock) != 0) {
+        double start = redmine_now_ms();
+        pthread_mutex_lock(&c->lock);
+        fprintf(stderr, "Waited %.0f ms for %s\n", redmine_now_ms() - start, c->name);
+    }
+    s = atomic_load(&c->current);
+    if (!s) {
+        s = meta_reload(c);
+        /* Have the refresh thread save what was just loaded */
+        if (redmine_refresh_running)
+            redmine_refresh_wake();
+    }
+    pthread_mutex_unlock(&c->lock);
+    return s;
+}
+
+static void meta_cleanup(MetaCollection* c)
+{
+    meta_snapshot_free(c, atomic_exchange(&c->current, NULL));
+}
+
+static void snapshot_put_u32(sds* out, uint32_t v)
+{
+    *out = sdscatlen(*out, &v, sizeof(v));
+}
+
+/* NULL is stored as length UINT32_MAX */
+static void snapshot_put_str(sds* out, const char* str)
+{
+    uint32_t len = str ? strlen(str) : UINT32_MAX;
+    snapshot_put_u32(out, len);
+    if (str)
+        *out = sdscatlen(*out, str, len);
+}
+
+static uint32_t snapshot_get_u32(SnapshotReader* r)
+{
+    uint32_t v = 0;
+    if ((size_t)(r->end - r->p) < sizeof(v)) {
+        r->ok = false;
+        return 0;
+    }
+    memcpy(&v, r->p, sizeof(v));
+    r->p += sizeof(v);
+    return v;
+}
+
+static char* snapshot_get_str(SnapshotReader* r)
+{
+    uint32_t len = snapshot_get_u32(r);
+    if (!r->ok || len == UINT32_MAX)
+        return NULL;
+    if ((size_t)(r->end - r->p) < len) {
+        r->ok = false;
+        return NULL;
+    }
+    char* str = strndup((const char*)r->p, len);
+    r->p += len;
+    return str;
+}
+
+static void meta_named_free(void* items)
 {
-    if (redmine_issue_statuses_instance)
-        return redmine_issue_statuses_instance;
+    NamedRecord* records = items;
+    for (int i = 0; i < stb_arr_len(records); i++)
+        free(records[i].name);
+    stb_arr_free(records);
+}
+
+static void meta_named_save(sds* out, const void* items)
+{
+    const NamedRecord* records = items;
+    snapshot_put_u32(out, stb_arr_len(records));
+    for (int i = 0; i < stb_arr_len(records); i++) {
+        snapshot_put_u32(out, records[i].id);
+        snapshot_put_str(out, records[i].name);
+    }
+}
+
+static bool meta_named_restore(SnapshotReader* r, MetaSnapshot* s)
+{
+    NamedRecord* records = NULL;
+    uint32_t n = snapshot_get_u32(r);
+    for (uint32_t i = 0; i < n && r->ok; i++) {
+        NamedRecord rec;
+        rec.id = snapshot_get_u32(r);
+        rec.name = snapshot_get_str(r);
+        if (!rec.name) {
+            r->ok = false;
+            break;
+        }
+        *stb_arr_add(records) = rec;
+    }
+    s->items = records;
+    return r->ok;
+}
+
+/*
+ * Issues statuses
+ */
 
+static bool redmine_issue_statuses_load(MetaSnapshot* s)
+{
     cJSON* json = redmine_get("issue_statuses.json");
     if (!json)
-        return NULL;
+        return false;
 
     cJSON* statuses = cJSON_Select(json, ".issue_statuses:a");
     if (!statuses) {
         cJSON_Delete(json);
-        return NULL;
+        return false;
     }
 
+    IssueStatus* items = NULL;
     cJSON* status = NULL;
     cJSON_ArrayForEach(status, statuses) {
         cJSON* id = cJSON_Select(status, ".id:n");
@@ -305,58 +750,45 @@ static IssueStatus* redmine_issue_statuses_get()
             IssueStatus i;
             i.id = id->valueint;
             i.name = strdup(name->valuestring);
-            *stb_arr_add(redmine_issue_statuses_instance) = i;
+            *stb_arr_add(items) = i;
         }
     }
 
     cJSON_Delete(json);
-    return redmine_issue_statuses_instance;
+    s->items = items;
+    return true;
 }
 
-static void redmine_issue_statuses_cleanup()
+static IssueStatus* redmine_issue_statuses_get()
 {
-    if (!redmine_issue_statuses_instance) return;
-    for (int i = 0; i < stb_arr_len(redmine_issue_statuses_instance); i++)
-        free(redmine_issue_statuses_instance[i].name);
-    stb_arr_free(redmine_issue_statuses_instance);
+    MetaSnapshot* s = meta_get(&redmine_metadata.statuses);
+    return s ? s->items : NULL;
 }
 
 static const char* redmine_status_id_to_name(int id)
 {
-    IssueStatus* redmine_issue_statuses = redmine_issue_statuses_get();
-    for (int i = 0; i < stb_arr_len(redmine_issue_statuses); i++) {
-        if (redmine_issue_statuses[i].id == id)
-            return redmine_issue_statuses[i].name;
-    }
-    return NULL;
+    MetaSnapshot* s = meta_get(&redmine_metadata.statuses);
+    int i = s ? meta_index_find(s->index, id) : -1;
+    return i >= 0 ? ((IssueStatus*)s->items)[i].name : NULL;
 }
 
 /*
  * Trackers
  */
 
-typedef struct {
-    int id;
-    char* name;
-} Tracker;
-
-static Tracker* redmine_trackers_instance = NULL;
-
-static Tracker* redmine_trackers_get()
+static bool redmine_trackers_load(MetaSnapshot* s)
 {
-    if (redmine_trackers_instance)
-        return redmine_trackers_instance;
-
     cJSON* json = redmine_get("trackers.json");
     if (!json)
-        return NULL;
+        return false;
 
     cJSON* trackers = cJSON_Select(json, ".trackers:a");
     if (!trackers) {
         cJSON_Delete(json);
-        return NULL;
+        return false;
     }
 
+    Tracker* items = NULL;
     cJSON* tracker = NULL;
     cJSON_ArrayForEach(tracker, trackers) {
         cJSON* id = cJSON_Select(tracker, ".id:n");
@@ -365,214 +797,2190 @@ static Tracker* redmine_trackers_get()
             Tracker t;
             t.id = id->valueint;
             t.name = strdup(name->valuestring);
-            *stb_arr_add(redmine_trackers_instance) = t;
+            *stb_arr_add(items) = t;
         }
     }
 
     cJSON_Delete(json);
-    return redmine_trackers_instance;
+    s->items = items;
+    return true;
+}
+
+static Tracker* redmine_trackers_get()
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.trackers);
+    return s ? s->items : NULL;
+}
+
+/*
+ * Projects
+ */
+
+static void redmine_projects_index_identifiers(MetaSnapshot* s)
+{
+    Project* projects = s->items;
+    /* Without an arena: stb's arena allocator misbehaves when stb.c is built with -O2 */
+    s->identifier_index = stb_sdict_new(0);
+    for (int i = 0; i < stb_arr_len(projects); i++)
+        stb_sdict_set(s->identifier_index, projects[i].identifier, &projects[i]);
+}
+
+static bool redmine_projects_load(MetaSnapshot* s)
+{
+    cJSON* json = redmine_get("projects.json");
+    if (!json)
+        return false;
+
+    cJSON* projects = cJSON_Select(json, ".projects:a");
+    if (!projects) {
+        cJSON_Delete(json);
+        return false;
+    }
+
+    Project* items = NULL;
+    cJSON* project = NULL;
+    cJSON_ArrayForEach(project, projects) {
+        cJSON* id = cJSON_Select(project, ".id:n");
+        cJSON* name = cJSON_Select(project, ".name:s");
+        cJSON* identifier = cJSON_Select(project, ".identifier:s");
+        cJSON* description = cJSON_Select(project, ".description:s");
+        if (id && name && identifier) {
+            Project p;
+            p.id = id->valueint;
+            p.name = strdup(name->valuestring);
+            p.identifier = strdup(identifier->valuestring);
+            p.description = description ? strdup(description->valuestring) : NULL;
+            *stb_arr_add(items) = p;
+        }
+    }
+
+    cJSON_Delete(json);
+    s->items = items;
+    redmine_projects_index_identifiers(s);
+    return true;
+}
+
+static void redmine_projects_free(void* items)
+{
+    Project* projects = items;
+    for (int i = 0; i < stb_arr_len(projects); i++) {
+        free(projects[i].name);
+        free(projects[i].identifier);
+        if (projects[i].description)
+            free(projects[i].description);
+    }
+    stb_arr_free(projects);
+}
+
+static void redmine_projects_save(sds* out, const void* items)
+{
+    const Project* projects = items;
+    snapshot_put_u32(out, stb_arr_len(projects));
+    for (int i = 0; i < stb_arr_len(projects); i++) {
+        snapshot_put_u32(out, projects[i].id);
+        snapshot_put_str(out, projects[i].name);
+        snapshot_put_str(out, projects[i].identifier);
+        snapshot_put_str(out, projects[i].description);
+    }
+}
+
+static bool redmine_projects_restore(SnapshotReader* r, MetaSnapshot* s)
+{
+    Project* projects = NULL;
+    uint32_t n = snapshot_get_u32(r);
+    for (uint32_t i = 0; i < n && r->ok; i++) {
+        Project p;
+        p.id = snapshot_get_u32(r);
+        p.name = snapshot_get_str(r);
+        p.identifier = snapshot_get_str(r);
+        p.description = snapshot_get_str(r);
+        if (!p.name || !p.identifier)
+            r->ok = false;
+        *stb_arr_add(projects) = p;
+    }
+    s->items = projects;
+    if (r->ok)
+        redmine_projects_index_identifiers(s);
+    return r->ok;
+}
+
+static Project* redmine_projects_get()
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.projects);
+    return s ? s->items : NULL;
+}
+
+static Project* redmine_project_by_id(int id)
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.projects);
+    int i = s ? meta_index_find(s->index, id) : -1;
+    return i >= 0 ? &((Project*)s->items)[i] : NULL;
+}
+
+static Project* redmine_project_by_identifier(const char* identifier)
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.projects);
+    if (!s || !s->identifier_index)
+        return NULL;
+    return stb_sdict_get(s->identifier_index, (char*)identifier);
+}
+
+/*
+ * Versions
+ */
+
+static bool redmine_versions_load(MetaSnapshot* s)
+{
+    MetaSnapshot* ps = meta_get(&redmine_metadata.projects);
+    if (!ps)
+        return false;
+
+    Project* redmine_projects = ps->items;
+    int nprojects = stb_arr_len(redmine_projects);
+
+    /* One request per project, REDMINE_MAX_PARALLEL at a time */
+    HttpRequest* reqs = calloc(nprojects > 0 ? nprojects : 1, sizeof(HttpRequest));
+    if (!reqs)
+        return false;
+
+    for (int i = 0; i < nprojects; i++) {
+        char path[256];
+        char url[512];
+        snprintf(path, sizeof(path), "projects/%d/versions.json", redmine_projects[i].id);
+        redmine_url(url, sizeof(url), path);
+        reqs[i].url = strdup(url);
+    }
+
+    http_get_json_many(reqs, nprojects, redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    Version* items = NULL;
+    for (int i = 0; i < nprojects; i++) {
+        cJSON* json = reqs[i].json;
+        free((char*)reqs[i].url);
+        if (!json)
+            continue;
+
+        cJSON* versions = cJSON_Select(json, ".versions:a");
+        if (!versions) {
+            cJSON_Delete(json);
+            continue;
+        }
+
+        cJSON* version = NULL;
+        cJSON_ArrayForEach(version, versions) {
+            cJSON* id = cJSON_Select(version, ".id:n");
+            cJSON* name = cJSON_Select(version, ".name:s");
+            if (id && name) {
+                Version v;
+                v.id = id->valueint;
+                v.name = strdup(name->valuestring);
+                v.project_id = redmine_projects[i].id;
+                *stb_arr_add(items) = v;
+            }
+        }
+
+        cJSON_Delete(json);
+    }
+
+    free(reqs);
+    s->items = items;
+    return true;
+}
+
+static void redmine_versions_free(void* items)
+{
+    Version* versions = items;
+    for (int i = 0; i < stb_arr_len(versions); i++)
+        free(versions[i].name);
+    stb_arr_free(versions);
+}
+
+static void redmine_versions_save(sds* out, const void* items)
+{
+    const Version* versions = items;
+    snapshot_put_u32(out, stb_arr_len(versions));
+    for (int i = 0; i < stb_arr_len(versions); i++) {
+        snapshot_put_u32(out, versions[i].id);
+        snapshot_put_u32(out, versions[i].project_id);
+        snapshot_put_str(out, versions[i].name);
+    }
+}
+
+static bool redmine_versions_restore(SnapshotReader* r, MetaSnapshot* s)
+{
+    Version* versions = NULL;
+    uint32_t n = snapshot_get_u32(r);
+    for (uint32_t i = 0; i < n && r->ok; i++) {
+        Version v;
+        v.id = snapshot_get_u32(r);
+        v.project_id = snapshot_get_u32(r);
+        v.name = snapshot_get_str(r);
+        if (!v.name) {
+            r->ok = false;
+            break;
+        }
+        *stb_arr_add(versions) = v;
+    }
+    s->items = versions;
+    return r->ok;
+}
+
+static Version* redmine_versions_get()
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.versions);
+    return s ? s->items : NULL;
+}
+
+static const char* redmine_version_id_to_name(int id)
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.versions);
+    int i = s ? meta_index_find(s->index, id) : -1;
+    return i >= 0 ? ((Version*)s->items)[i].name : NULL;
+}
+
+/*
+ * Time entry activities
+ */
+
+static bool redmine_time_entry_activities_load(MetaSnapshot* s)
+{
+    cJSON* json = redmine_get("enumerations/time_entry_activities.json");
+    if (!json)
+        return false;
+
+    cJSON* activities = cJSON_Select(json, ".time_entry_activities:a");
+    if (!activities) {
+        cJSON_Delete(json);
+        return false;
+    }
+
+    TimeEntryActivity* items = NULL;
+    cJSON* activity = NULL;
+    cJSON_ArrayForEach(activity, activities) {
+        cJSON* id = cJSON_Select(activity, ".id:n");
+        cJSON* name = cJSON_Select(activity, ".name:s");
+        if (id && name) {
+            TimeEntryActivity t;
+            t.id = id->valueint;
+            t.name = strdup(name->valuestring);
+            *stb_arr_add(items) = t;
+        }
+    }
+
+    cJSON_Delete(json);
+    s->items = items;
+    return true;
+}
+
+static TimeEntryActivity* redmine_time_entry_activities_get()
+{
+    MetaSnapshot* s = meta_get(&redmine_metadata.activities);
+    return s ? s->items : NULL;
+}
+
+/*
+ * Metadata refresh
+ */
+
+static RedmineMetadata redmine_metadata = {
+    .statuses = {
+        .name = "issue statuses",
+        .ttl = REDMINE_ENUMERATION_TTL,
+        .record_size = sizeof(IssueStatus),
+        .load = redmine_issue_statuses_load,
+        .free_items = meta_named_free,
+        .save = meta_named_save,
+        .restore = meta_named_restore,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+    .trackers = {
+        .name = "trackers",
+        .ttl = REDMINE_ENUMERATION_TTL,
+        .record_size = sizeof(Tracker),
+        .load = redmine_trackers_load,
+        .free_items = meta_named_free,
+        .save = meta_named_save,
+        .restore = meta_named_restore,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+    .projects = {
+        .name = "projects",
+        .ttl = REDMINE_PROJECT_TTL,
+        .record_size = sizeof(Project),
+        .load = redmine_projects_load,
+        .free_items = redmine_projects_free,
+        .save = redmine_projects_save,
+        .restore = redmine_projects_restore,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+    .versions = {
+        .name = "versions",
+        .ttl = REDMINE_PROJECT_TTL,
+        .record_size = sizeof(Version),
+        .load = redmine_versions_load,
+        .free_items = redmine_versions_free,
+        .save = redmine_versions_save,
+        .restore = redmine_versions_restore,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+    .activities = {
+        .name = "time entry activities",
+        .ttl = REDMINE_ENUMERATION_TTL,
+        .record_size = sizeof(TimeEntryActivity),
+        .load = redmine_time_entry_activities_load,
+        .free_items = meta_named_free,
+        .save = meta_named_save,
+        .restore = meta_named_restore,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    },
+};
+
+static MetaCollection* const redmine_collections[] = {
+    &redmine_metadata.statuses,
+    &redmine_metadata.trackers,
+    &redmine_metadata.projects,
+    &redmine_metadata.versions,
+    &redmine_metadata.activities,
+};
+
+#define REDMINE_COLLECTIONS_LEN (sizeof(redmine_collections) / sizeof(redmine_collections[0]))
+
+/*
+ * Metadata snapshot file
+ *
+ * Loaded collections are also written to a small binary file, so a restarted
+ * server can answer from it right away. The file is mmap'd at startup and
+ * only used if it was written for the same server URL and API key and is at
+ * most REDMINE_SNAPSHOT_MAX_AGE old. The refresh thread then reloads every
+ * restored collection in the background.
+ */
+
+#define REDMINE_SNAPSHOT_MAGIC 0x534d4452 /* "RDMS" */
+#define REDMINE_SNAPSHOT_VERSION 1
+#define REDMINE_SNAPSHOT_MAX_AGE (24 * 60 * 60)
+
+static char* redmine_snapshot_path = NULL;
+static bool redmine_snapshot_restored = false;
+static pthread_mutex_t redmine_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* One file per server under the user's cache directory, NULL if there is
+ * no cache directory */
+static char* redmine_cache_path(const char* extension)
+{
+    if (!redmine_base_url || !redmine_api_key)
+        return NULL;
+
+    sds dir;
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg)
+        dir = sdsnew(xdg);
+    else if (home && *home)
+        dir = sdscatprintf(sdsempty(), "%s/.cache", home);
+    else
+        return NULL;
+
+    mkdir(dir, 0700);
+    sds file = sdscatprintf(sdsempty(), "%s/libmcp-redmine-%08x.%s",
+                            dir, stb_hash((char*)redmine_base_url), extension);
+    char* path = strdup(file);
+    sdsfree(file);
+    sdsfree(dir);
+    return path;
+}
+
+/* REDMINE_SNAPSHOT_FILE, or the default cache file */
+static void redmine_snapshot_path_init()
+{
+    const char* path = getenv("REDMINE_SNAPSHOT_FILE");
+    if (path) {
+        if (*path)
+            redmine_snapshot_path = strdup(path);
+        return;
+    }
+    redmine_snapshot_path = redmine_cache_path("snapshot");
+}
+
+static void redmine_snapshot_save()
+{
+    if (!redmine_snapshot_path)
+        return;
+
+    pthread_mutex_lock(&redmine_snapshot_lock);
+
+    sds out = sdsempty();
+    snapshot_put_u32(&out, REDMINE_SNAPSHOT_MAGIC);
+    snapshot_put_u32(&out, REDMINE_SNAPSHOT_VERSION);
+    snapshot_put_u32(&out, stb_hash((char*)redmine_base_url));
+    snapshot_put_u32(&out, stb_hash((char*)redmine_api_key));
+    snapshot_put_u32(&out, (uint32_t)time(NULL));
+    snapshot_put_u32(&out, redmine_user_id);
+    snapshot_put_u32(&out, REDMINE_COLLECTIONS_LEN);
+    for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++) {
+        MetaCollection* c = redmine_collections[i];
+        MetaSnapshot* snap = atomic_load(&c->current);
+        snapshot_put_u32(&out, snap != NULL);
+        if (snap)
+            c->save(&out, snap->items);
+    }
+
+    /* Write aside and rename, so readers never see a partial file */
+    sds tmp = sdscatprintf(sdsempty(), "%s.%d", redmine_snapshot_path, (int)getpid());
+    FILE* f = fopen(tmp, "wb");
+    if (f) {
+        bool ok = fwrite(out, 1, sdslen(out), f) == sdslen(out);
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp, redmine_snapshot_path) != 0)
+            unlink(tmp);
+    }
+    sdsfree(tmp);
+    sdsfree(out);
+
+    pthread_mutex_unlock(&redmine_snapshot_lock);
+}
+
+/* Called before the refresh thread starts */
+static void redmine_snapshot_restore()
+{
+    if (!redmine_snapshot_path || !redmine_base_url || !redmine_api_key)
+        return;
+
+    int fd = open(redmine_snapshot_path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    SnapshotReader r = { map, (const unsigned char*)map + st.st_size, true };
+    MetaSnapshot* restored[REDMINE_COLLECTIONS_LEN] = { 0 };
+
+    uint32_t magic = snapshot_get_u32(&r);
+    uint32_t version = snapshot_get_u32(&r);
+    uint32_t url_hash = snapshot_get_u32(&r);
+    uint32_t key_hash = snapshot_get_u32(&r);
+    time_t saved_at = snapshot_get_u32(&r);
+    int user_id = snapshot_get_u32(&r);
+    uint32_t ncollections = snapshot_get_u32(&r);
+    time_t age = time(NULL) - saved_at;
+
+    if (!r.ok || magic != REDMINE_SNAPSHOT_MAGIC || version != REDMINE_SNAPSHOT_VERSION
+        || url_hash != stb_hash((char*)redmine_base_url)
+        || key_hash != stb_hash((char*)redmine_api_key)
+        || ncollections != REDMINE_COLLECTIONS_LEN
+        || age < 0 || age > REDMINE_SNAPSHOT_MAX_AGE)
+        goto done;
+
+    for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN && r.ok; i++) {
+        MetaCollection* c = redmine_collections[i];
+        if (!snapshot_get_u32(&r))
+            continue;
+        restored[i] = calloc(1, sizeof(MetaSnapshot));
+        if (!restored[i] || !c->restore(&r, restored[i]))
+            r.ok = false;
+    }
+
+    if (!r.ok) {
+        for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++)
+            meta_snapshot_free(redmine_collections[i], restored[i]);
+        goto done;
+    }
+
+    /* Serve the restored data, but reload it as soon as the thread runs */
+    for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++) {
+        MetaCollection* c = redmine_collections[i];
+        MetaSnapshot* snap = restored[i];
+        if (!snap)
+            continue;
+        snap->index = meta_index_build(snap->items, stb_arr_len(snap->items), c->record_size);
+        atomic_store(&c->current, snap);
+        atomic_store(&c->refresh_at, 0);
+        atomic_store(&c->stale, true);
+    }
+    redmine_user_id = user_id;
+    redmine_snapshot_restored = true;
+    redmine_refresh_pending = true;
+    fprintf(stderr, "Restored metadata snapshot from %s (%lds old)\n",
+            redmine_snapshot_path, (long)age);
+
+done:
+    munmap(map, st.st_size);
+}
+
+/*
+ * Wiki search index
+ *
+ * With REDMINE_WIKI_INDEX set, search_wiki answers from a local full-text
+ * index of all project wikis instead of Redmine's search.json. The index is
+ * one file, mmap'd for queries:
+ *
+ *   header     magic, version, url and key hash, built_at, ndocs, nterms,
+ *              total body and title words
+ *   docs[]     offset of each doc record
+ *   terms[]    offset of each term record, sorted by term
+ *   term       term, doc count, title doc count, postings size, postings
+ *   doc        project id, body words, title words, project identifier,
+ *              title, updated_on, excerpt
+ *
+ * Postings are varints of doc delta, body count and title count. The refresh
+ * thread updates the file every REDMINE_WIKI_INDEX_TTL, only fetching pages
+ * whose updated_on changed; the postings of the others are carried over.
+ *
+ * Queries are ranked with BM25. Like Redmine's own search, a query word also
+ * matches longer words it is a prefix of. Until the first build is done,
+ * search_wiki keeps using search.json.
+ */
+
+#define REDMINE_WIKI_INDEX_MAGIC 0x49574452 /* "RDWI" */
+#define REDMINE_WIKI_INDEX_VERSION 1
+#define REDMINE_WIKI_INDEX_HEADER 9
+#define REDMINE_WIKI_INDEX_TTL (15 * 60)
+/* Pages fetched per batch while building */
+#define REDMINE_WIKI_FETCH_BATCH 64
+#define REDMINE_WIKI_TERM_MAX 64
+#define REDMINE_WIKI_QUERY_MAX 32
+#define REDMINE_WIKI_EXCERPT 240
+
+/* BM25 parameters. A word in the title counts as WIKI_TITLE_BOOST words in
+ * the body. */
+#define WIKI_BM25_K1 1.2
+#define WIKI_BM25_B 0.75
+#define WIKI_TITLE_BOOST 3
+
+typedef struct {
+    void* map;
+    size_t size;
+    time_t built_at;
+    uint32_t ndocs;
+    uint32_t nterms;
+    double avg_len;         /* words per doc, title included */
+    double avg_title_len;
+    const uint32_t* docs;   /* doc record offsets */
+    const uint32_t* terms;  /* term record offsets, sorted by term */
+} WikiIndex;
+
+/* A doc's count of one term */
+typedef struct {
+    int term;
+    uint32_t tf;
+    uint32_t title_tf;
+} WikiDocTerm;
+
+typedef struct {
+    int project_id;
+    char* project;
+    char* title;
+    char* updated_on;
+    char* excerpt;
+    uint32_t len;
+    uint32_t title_len;
+    WikiDocTerm* terms;     /* stb_arr, sorted by term */
+    bool keep;
+} WikiDoc;
+
+/* In-memory form of the index while it is updated */
+typedef struct {
+    WikiDoc* docs;          /* stb_arr */
+    char** terms;           /* stb_arr, by term id */
+    stb_sdict* term_ids;    /* term -> id + 1 */
+} WikiIndexBuilder;
+
+typedef struct {
+    uint32_t doc;
+    double score;
+} WikiHit;
+
+static char* redmine_wiki_index_path = NULL;
+static _Atomic(WikiIndex*) redmine_wiki_index;
+static _Atomic(time_t) redmine_wiki_index_refresh_at;
+static atomic_bool redmine_wiki_index_stale;
+
+/* Calls fn with each lowercased word of text. Words are runs of ASCII letters
+ * and digits or of non-ASCII bytes, so UTF-8 text stays whole. */
+static void wiki_tokenize(const char* text, void (*fn)(const char* word, size_t len, void* userp),
+                          void* userp)
+{
+    char word[REDMINE_WIKI_TERM_MAX];
+    size_t len = 0;
+    for (const unsigned char* p = (const unsigned char*)text; ; p++) {
+        unsigned char c = *p;
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+            if (len < sizeof(word))
+                word[len++] = c;
+            continue;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            if (len < sizeof(word))
+                word[len++] = c - 'A' + 'a';
+            continue;
+        }
+        if (len)
+            fn(word, len, userp);
+        len = 0;
+        if (!c)
+            break;
+    }
+}
+
+static void wiki_put_varint(sds* out, uint32_t v)
+{
+    unsigned char buf[5];
+    int n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    *out = sdscatlen(*out, buf, n);
+}
+
+static uint32_t wiki_get_varint(SnapshotReader* r)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35 && r->p < r->end; shift += 7) {
+        unsigned char c = *r->p++;
+        v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+    r->ok = false;
+    return 0;
+}
+
+/* Like snapshot_get_str(), but points into the mapped file */
+static const char* wiki_get_bytes(SnapshotReader* r, uint32_t* len)
+{
+    *len = snapshot_get_u32(r);
+    if (!r->ok || *len == UINT32_MAX || (size_t)(r->end - r->p) < *len) {
+        r->ok = false;
+        *len = 0;
+        return "";
+    }
+    const char* bytes = (const char*)r->p;
+    r->p += *len;
+    return bytes;
+}
+
+static SnapshotReader wiki_index_reader(const WikiIndex* idx, uint32_t offset)
+{
+    const unsigned char* start = idx->map;
+    SnapshotReader r = { start + offset, start + idx->size, offset <= idx->size };
+    if (!r.ok)
+        r.p = r.end;
+    return r;
+}
+
+static void wiki_index_close(WikiIndex* idx)
+{
+    if (!idx) return;
+    munmap(idx->map, idx->size);
+    free(idx);
+}
+
+static void wiki_index_retired_free(void* owner, void* idx)
+{
+    (void)owner;
+    wiki_index_close(idx);
+}
+
+static WikiIndex* wiki_index_open(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= REDMINE_WIKI_INDEX_HEADER * 4)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const uint32_t* header = map;
+    uint64_t ndocs = header[5];
+    uint64_t nterms = header[6];
+    if (header[0] != REDMINE_WIKI_INDEX_MAGIC || header[1] != REDMINE_WIKI_INDEX_VERSION
+        || header[2] != stb_hash((char*)redmine_base_url)
+        || header[3] != stb_hash((char*)redmine_api_key)
+        || (REDMINE_WIKI_INDEX_HEADER + ndocs + nterms) * 4 > (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    WikiIndex* idx = calloc(1, sizeof(*idx));
+    if (!idx) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    idx->map = map;
+    idx->size = st.st_size;
+    idx->built_at = header[4];
+    idx->ndocs = ndocs;
+    idx->nterms = nterms;
+    idx->avg_len = ndocs ? ((double)header[7] + header[8]) / ndocs : 0;
+    idx->avg_title_len = ndocs ? (double)header[8] / ndocs : 0;
+    idx->docs = header + REDMINE_WIKI_INDEX_HEADER;
+    idx->terms = idx->docs + ndocs;
+    return idx;
+}
+
+static void wiki_builder_init(WikiIndexBuilder* b)
+{
+    b->docs = NULL;
+    b->terms = NULL;
+    b->term_ids = stb_sdict_new(0);
+}
+
+static void wiki_doc_free(WikiDoc* d)
+{
+    free(d->project);
+    free(d->title);
+    free(d->updated_on);
+    free(d->excerpt);
+    stb_arr_free(d->terms);
+}
+
+static void wiki_builder_free(WikiIndexBuilder* b)
+{
+    for (int i = 0; i < stb_arr_len(b->docs); i++)
+        wiki_doc_free(&b->docs[i]);
+    stb_arr_free(b->docs);
+    for (int i = 0; i < stb_arr_len(b->terms); i++)
+        free(b->terms[i]);
+    stb_arr_free(b->terms);
+    stb_sdict_delete(b->term_ids);
+}
+
+static int wiki_builder_term(WikiIndexBuilder* b, const char* word, size_t len)
+{
+    char term[REDMINE_WIKI_TERM_MAX + 1];
+    memcpy(term, word, len);
+    term[len] = '\0';
+
+    intptr_t id = (intptr_t)stb_sdict_get(b->term_ids, term);
+    if (id)
+        return id - 1;
+    *stb_arr_add(b->terms) = strdup(term);
+    stb_sdict_set(b->term_ids, term, (void*)(intptr_t)stb_arr_len(b->terms));
+    return stb_arr_len(b->terms) - 1;
+}
+
+typedef struct {
+    WikiIndexBuilder* b;
+    WikiDocTerm* terms;
+    bool title;
+    uint32_t len;
+} WikiDocTokens;
+
+static void wiki_doc_add_word(const char* word, size_t len, void* userp)
+{
+    WikiDocTokens* t = userp;
+    WikiDocTerm dt = { wiki_builder_term(t->b, word, len), !t->title, t->title };
+    *stb_arr_add(t->terms) = dt;
+    t->len++;
+}
+
+static int wiki_doc_term_compare(const void* a, const void* b)
+{
+    const WikiDocTerm* x = a;
+    const WikiDocTerm* y = b;
+    return (x->term > y->term) - (x->term < y->term);
+}
+
+/* Replace the words of d with those of title and text */
+static void wiki_doc_set_text(WikiIndexBuilder* b, WikiDoc* d, const char* title, const char* text)
+{
+    WikiDocTokens t = { b, NULL, true, 0 };
+    wiki_tokenize(title, wiki_doc_add_word, &t);
+    d->title_len = t.len;
+    t.title = false;
+    t.len = 0;
+    wiki_tokenize(text, wiki_doc_add_word, &t);
+    d->len = t.len;
+
+    /* One entry per term */
+    int n = stb_arr_len(t.terms);
+    if (n > 0)
+        qsort(t.terms, n, sizeof(WikiDocTerm), wiki_doc_term_compare);
+    int out = 0;
+    for (int i = 0; i < n; i++) {
+        if (out > 0 && t.terms[out - 1].term == t.terms[i].term) {
+            t.terms[out - 1].tf += t.terms[i].tf;
+            t.terms[out - 1].title_tf += t.terms[i].title_tf;
+        } else {
+            t.terms[out++] = t.terms[i];
+        }
+    }
+    if (t.terms)
+        stb_arr_setlen(t.terms, out);
+
+    stb_arr_free(d->terms);
+    d->terms = t.terms;
+
+    /* The start of the text, on one line, as the search result description */
+    size_t len = strlen(text);
+    if (len > REDMINE_WIKI_EXCERPT) {
+        len = REDMINE_WIKI_EXCERPT;
+        while (len > 0 && ((unsigned char)text[len] & 0xc0) == 0x80)
+            len--;
+    }
+    free(d->excerpt);
+    d->excerpt = strndup(text, len);
+    for (char* p = d->excerpt; *p; p++) {
+        if (*p == '\r' || *p == '\n')
+            *p = ' ';
+    }
+}
+
+/* Turn a mapped index back into docs, so unchanged pages need no refetch */
+static bool wiki_builder_load(WikiIndexBuilder* b, const WikiIndex* idx)
+{
+    bool ok = true;
+    for (uint32_t i = 0; i < idx->ndocs && ok; i++) {
+        SnapshotReader r = wiki_index_reader(idx, idx->docs[i]);
+        WikiDoc d = { 0 };
+        d.project_id = snapshot_get_u32(&r);
+        d.len = snapshot_get_u32(&r);
+        d.title_len = snapshot_get_u32(&r);
+        d.project = snapshot_get_str(&r);
+        d.title = snapshot_get_str(&r);
+        d.updated_on = snapshot_get_str(&r);
+        d.excerpt = snapshot_get_str(&r);
+        ok = r.ok && d.project && d.title && d.updated_on && d.excerpt;
+        *stb_arr_add(b->docs) = d;
+    }
+
+    for (uint32_t i = 0; i < idx->nterms && ok; i++) {
+        SnapshotReader r = wiki_index_reader(idx, idx->terms[i]);
+        uint32_t len;
+        const char* word = wiki_get_bytes(&r, &len);
+        snapshot_get_u32(&r);
+        snapshot_get_u32(&r);
+        uint32_t size = snapshot_get_u32(&r);
+        if (!r.ok || len == 0 || len > REDMINE_WIKI_TERM_MAX || (size_t)(r.end - r.p) < size) {
+            ok = false;
+            break;
+        }
+        int term = wiki_builder_term(b, word, len);
+
+        SnapshotReader postings = { r.p, r.p + size, true };
+        uint32_t doc = 0;
+        while (postings.p < postings.end && postings.ok) {
+            doc += wiki_get_varint(&postings);
+            WikiDocTerm dt;
+            dt.term = term;
+            dt.tf = wiki_get_varint(&postings);
+            dt.title_tf = wiki_get_varint(&postings);
+            if (!postings.ok || doc >= idx->ndocs)
+                break;
+            *stb_arr_add(b->docs[doc].terms) = dt;
+        }
+        ok = postings.ok && postings.p == postings.end;
+    }
+    return ok;
+}
+
+/* Terms being sorted by wiki_term_compare() */
+static char** wiki_sort_terms;
+
+static int wiki_term_compare(const void* a, const void* b)
+{
+    return strcmp(wiki_sort_terms[*(const int*)a], wiki_sort_terms[*(const int*)b]);
+}
+
+/* Serialize the builder's docs into the index file format */
+static sds wiki_builder_write(WikiIndexBuilder* b)
+{
+    int ndocs = stb_arr_len(b->docs);
+    int nterms = stb_arr_len(b->terms);
+
+    /* Invert the docs into per term postings */
+    sds* postings = calloc(nterms > 0 ? nterms : 1, sizeof(sds));
+    uint32_t* df = calloc(nterms > 0 ? nterms : 1, sizeof(uint32_t));
+    uint32_t* title_df = calloc(nterms > 0 ? nterms : 1, sizeof(uint32_t));
+    uint32_t* last = calloc(nterms > 0 ? nterms : 1, sizeof(uint32_t));
+    int* order = malloc((nterms > 0 ? nterms : 1) * sizeof(int));
+    if (!postings || !df || !title_df || !last || !order) {
+        free(postings);
+        free(df);
+        free(title_df);
+        free(last);
+        free(order);
+        return NULL;
+    }
+
+    uint32_t total_len = 0;
+    uint32_t total_title_len = 0;
+    for (int i = 0; i < ndocs; i++) {
+        WikiDoc* d = &b->docs[i];
+        total_len += d->len;
+        total_title_len += d->title_len;
+        for (int j = 0; j < stb_arr_len(d->terms); j++) {
+            WikiDocTerm* dt = &d->terms[j];
+            if (!postings[dt->term])
+                postings[dt->term] = sdsempty();
+            wiki_put_varint(&postings[dt->term], i - last[dt->term]);
+            wiki_put_varint(&postings[dt->term], dt->tf);
+            wiki_put_varint(&postings[dt->term], dt->title_tf);
+            last[dt->term] = i;
+            df[dt->term] += dt->tf > 0 || dt->title_tf > 0;
+            title_df[dt->term] += dt->title_tf > 0;
+        }
+    }
+
+    /* Terms of removed pages have no postings left */
+    int nused = 0;
+    for (int i = 0; i < nterms; i++) {
+        if (postings[i])
+            order[nused++] = i;
+    }
+    wiki_sort_terms = b->terms;
+    qsort(order, nused, sizeof(int), wiki_term_compare);
+
+    sds out = sdsempty();
+    snapshot_put_u32(&out, REDMINE_WIKI_INDEX_MAGIC);
+    snapshot_put_u32(&out, REDMINE_WIKI_INDEX_VERSION);
+    snapshot_put_u32(&out, stb_hash((char*)redmine_base_url));
+    snapshot_put_u32(&out, stb_hash((char*)redmine_api_key));
+    snapshot_put_u32(&out, (uint32_t)time(NULL));
+    snapshot_put_u32(&out, ndocs);
+    snapshot_put_u32(&out, nused);
+    snapshot_put_u32(&out, total_len);
+    snapshot_put_u32(&out, total_title_len);
+
+    /* Offset tables, filled in below */
+    size_t tables = sdslen(out);
+    out = sdsgrowzero(out, tables + (size_t)(ndocs + nused) * 4);
+    uint32_t offset;
+
+    for (int i = 0; i < nused; i++) {
+        int term = order[i];
+        offset = sdslen(out);
+        memcpy(out + tables + (size_t)(ndocs + i) * 4, &offset, 4);
+        snapshot_put_str(&out, b->terms[term]);
+        snapshot_put_u32(&out, df[term]);
+        snapshot_put_u32(&out, title_df[term]);
+        snapshot_put_u32(&out, sdslen(postings[term]));
+        out = sdscatsds(out, postings[term]);
+    }
+
+    for (int i = 0; i < ndocs; i++) {
+        WikiDoc* d = &b->docs[i];
+        offset = sdslen(out);
+        memcpy(out + tables + (size_t)i * 4, &offset, 4);
+        snapshot_put_u32(&out, d->project_id);
+        snapshot_put_u32(&out, d->len);
+        snapshot_put_u32(&out, d->title_len);
+        snapshot_put_str(&out, d->project);
+        snapshot_put_str(&out, d->title);
+        snapshot_put_str(&out, d->updated_on);
+        snapshot_put_str(&out, d->excerpt);
+    }
+
+    for (int i = 0; i < nterms; i++)
+        sdsfree(postings[i]);
+    free(postings);
+    free(df);
+    free(title_df);
+    free(last);
+    free(order);
+    return out;
+}
+
+/* Which wiki page to fetch, and the doc it replaces if any */
+typedef struct {
+    const Project* project;
+    char* title;
+    char* updated_on;
+    int doc;
+} WikiFetch;
+
+static void wiki_fetch_apply(WikiIndexBuilder* b, WikiFetch* f, cJSON* json)
+{
+    cJSON* text = cJSON_Select(json, ".wiki_page.text:s");
+    if (!text) {
+        /* Keep the old version, it is fetched again next time */
+        if (f->doc >= 0)
+            b->docs[f->doc].keep = true;
+        return;
+    }
+
+    WikiDoc* d;
+    if (f->doc < 0) {
+        d = stb_arr_add(b->docs);
+        memset(d, 0, sizeof(*d));
+        d->project_id = f->project->id;
+        d->project = strdup(f->project->identifier);
+        d->title = strdup(f->title);
+        f->doc = stb_arr_len(b->docs) - 1;
+    } else {
+        d = &b->docs[f->doc];
+    }
+    free(d->updated_on);
+    d->updated_on = strdup(f->updated_on);
+    d->keep = true;
+    wiki_doc_set_text(b, d, f->title, text->valuestring);
+}
+
+static void wiki_fetch_pages(WikiIndexBuilder* b, WikiFetch* fetches, int n)
+{
+    HttpRequest* reqs = calloc(n > 0 ? n : 1, sizeof(HttpRequest));
+    if (!reqs)
+        return;
+
+    for (int i = 0; i < n; i++) {
+        char* title = curl_easy_escape(NULL, fetches[i].title, 0);
+        char path[512];
+        char url[1024];
+        snprintf(path, sizeof(path), "projects/%d/wiki/%s.json", fetches[i].project->id, title);
+        curl_free(title);
+        redmine_url(url, sizeof(url), path);
+        reqs[i].url = strdup(url);
+    }
+
+    http_get_json_many(reqs, n, redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    for (int i = 0; i < n; i++) {
+        wiki_fetch_apply(b, &fetches[i], reqs[i].json);
+        cJSON_Delete(reqs[i].json);
+        free((char*)reqs[i].url);
+    }
+    free(reqs);
+}
+
+/* Bring the index up to date with the wikis of all projects. Runs on the
+ * refresh thread. */
+static bool redmine_wiki_index_update()
+{
+    double start = redmine_now_ms();
+
+    MetaSnapshot* ps = meta_get(&redmine_metadata.projects);
+    if (!ps)
+        return false;
+    Project* projects = ps->items;
+    int nprojects = stb_arr_len(projects);
+
+    WikiIndexBuilder b;
+    wiki_builder_init(&b);
+    WikiIndex* current = atomic_load(&redmine_wiki_index);
+    if (current && !wiki_builder_load(&b, current)) {
+        wiki_builder_free(&b);
+        wiki_builder_init(&b);
+    }
+
+    stb_sdict* docs_by_page = stb_sdict_new(0);
+    stb_sdict* projects_kept = stb_sdict_new(0);
+    for (int i = 0; i < stb_arr_len(b.docs); i++) {
+        sds key = sdscatprintf(sdsempty(), "%d/%s", b.docs[i].project_id, b.docs[i].title);
+        stb_sdict_set(docs_by_page, key, (void*)(intptr_t)(i + 1));
+        sdsfree(key);
+    }
+
+    /* Page lists of all projects */
+    HttpRequest* reqs = calloc(nprojects > 0 ? nprojects : 1, sizeof(HttpRequest));
+    if (!reqs) {
+        stb_sdict_delete(docs_by_page);
+        stb_sdict_delete(projects_kept);
+        wiki_builder_free(&b);
+        return false;
+    }
+    for (int i = 0; i < nprojects; i++) {
+        char path[256];
+        char url[512];
+        snprintf(path, sizeof(path), "projects/%d/wiki/index.json", projects[i].id);
+        redmine_url(url, sizeof(url), path);
+        reqs[i].url = strdup(url);
+    }
+    http_get_json_many(reqs, nprojects, redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    WikiFetch* fetches = NULL;
+    for (int i = 0; i < nprojects; i++) {
+        cJSON* pages = cJSON_Select(reqs[i].json, ".wiki_pages:a");
+        char key[32];
+        snprintf(key, sizeof(key), "%d", projects[i].id);
+
+        /* Without a wiki (or access to it) the project's pages go, after any
+         * other failure they stay as they are */
+        if (!pages) {
+            if (reqs[i].status != 403 && reqs[i].status != 404)
+                stb_sdict_set(projects_kept, key, (void*)1);
+            continue;
+        }
+
+        cJSON* page = NULL;
+        cJSON_ArrayForEach(page, pages) {
+            cJSON* title = cJSON_Select(page, ".title:s");
+            cJSON* updated_on = cJSON_Select(page, ".updated_on:s");
+            if (!title || !updated_on)
+                continue;
+
+            sds doc_key = sdscatprintf(sdsempty(), "%d/%s", projects[i].id, title->valuestring);
+            int doc = (int)(intptr_t)stb_sdict_get(docs_by_page, doc_key) - 1;
+            sdsfree(doc_key);
+
+            if (doc >= 0 && strcmp(b.docs[doc].updated_on, updated_on->valuestring) == 0) {
+                b.docs[doc].keep = true;
+                continue;
+            }
+            WikiFetch f = { &projects[i], strdup(title->valuestring),
+                            strdup(updated_on->valuestring), doc };
+            *stb_arr_add(fetches) = f;
+        }
+    }
+
+    for (int i = 0; i < nprojects; i++) {
+        cJSON_Delete(reqs[i].json);
+        free((char*)reqs[i].url);
+    }
+    free(reqs);
+
+    for (int i = 0; i < stb_arr_len(b.docs); i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "%d", b.docs[i].project_id);
+        if (stb_sdict_get(projects_kept, key))
+            b.docs[i].keep = true;
+    }
+
+    /* Fetch new and changed pages in batches, so only a batch of page bodies
+     * is held at a time */
+    int nfetches = stb_arr_len(fetches);
+    bool stopped = false;
+    for (int i = 0; i < nfetches && !stopped; i += REDMINE_WIKI_FETCH_BATCH) {
+        int n = nfetches - i < REDMINE_WIKI_FETCH_BATCH ? nfetches - i : REDMINE_WIKI_FETCH_BATCH;
+        wiki_fetch_pages(&b, fetches + i, n);
+
+        pthread_mutex_lock(&redmine_refresh_lock);
+        stopped = redmine_refresh_stop;
+        pthread_mutex_unlock(&redmine_refresh_lock);
+    }
+
+    /* Drop pages that are gone */
+    int kept = 0;
+    for (int i = 0; i < stb_arr_len(b.docs); i++) {
+        if (b.docs[i].keep)
+            b.docs[kept++] = b.docs[i];
+        else
+            wiki_doc_free(&b.docs[i]);
+    }
+    bool changed = nfetches > 0 || kept != stb_arr_len(b.docs);
+    if (b.docs)
+        stb_arr_setlen(b.docs, kept);
+
+    for (int i = 0; i < nfetches; i++) {
+        free(fetches[i].title);
+        free(fetches[i].updated_on);
+    }
+    stb_arr_free(fetches);
+    stb_sdict_delete(docs_by_page);
+    stb_sdict_delete(projects_kept);
+
+    if (stopped) {
+        wiki_builder_free(&b);
+        return false;
+    }
+    if (current && !changed) {
+        wiki_builder_free(&b);
+        return true;
+    }
+
+    sds out = wiki_builder_write(&b);
+    wiki_builder_free(&b);
+    if (!out)
+        return false;
+
+    bool ok = false;
+    sds tmp = sdscatprintf(sdsempty(), "%s.%d", redmine_wiki_index_path, (int)getpid());
+    FILE* f = fopen(tmp, "wb");
+    if (f) {
+        ok = fwrite(out, 1, sdslen(out), f) == sdslen(out);
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp, redmine_wiki_index_path) == 0;
+        if (!ok)
+            unlink(tmp);
+    }
+    sdsfree(tmp);
+    sdsfree(out);
+
+    WikiIndex* idx = ok ? wiki_index_open(redmine_wiki_index_path) : NULL;
+    if (!idx)
+        return false;
+
+    /* Queries may still be scanning the old mapping */
+    WikiIndex* old = atomic_exchange(&redmine_wiki_index, idx);
+    redmine_retire(wiki_index_retired_free, NULL, old);
+
+    fprintf(stderr, "Indexed %u wiki pages (%d fetched) in %.0f ms\n",
+            idx->ndocs, nfetches, redmine_now_ms() - start);
+    return true;
+}
+
+static void redmine_wiki_index_refresh()
+{
+    time_t retry = redmine_wiki_index_update() ? REDMINE_WIKI_INDEX_TTL : REDMINE_METADATA_RETRY;
+    atomic_store(&redmine_wiki_index_refresh_at, time(NULL) + retry);
+    atomic_store(&redmine_wiki_index_stale, false);
+}
+
+/* The current index, NULL if disabled or not built yet. Schedules an update
+ * once it expired. */
+static WikiIndex* redmine_wiki_index_get()
+{
+    if (!redmine_wiki_index_path)
+        return NULL;
+    if (time(NULL) >= atomic_load(&redmine_wiki_index_refresh_at)
+        && !atomic_exchange(&redmine_wiki_index_stale, true) && redmine_refresh_running)
+        redmine_refresh_wake();
+    return atomic_load(&redmine_wiki_index);
+}
+
+/* Called before the refresh thread starts */
+static void redmine_wiki_index_init()
+{
+    const char* path = getenv("REDMINE_WIKI_INDEX");
+    if (!path || !*path || strcmp(path, "0") == 0)
+        return;
+    redmine_wiki_index_path = strcmp(path, "1") == 0 ? redmine_cache_path("wiki") : strdup(path);
+    if (!redmine_wiki_index_path || !redmine_base_url || !redmine_api_key)
+        return;
+
+    /* Serve the existing index, but bring it up to date right away */
+    WikiIndex* idx = wiki_index_open(redmine_wiki_index_path);
+    atomic_store(&redmine_wiki_index, idx);
+    atomic_store(&redmine_wiki_index_refresh_at, 0);
+    atomic_store(&redmine_wiki_index_stale, true);
+    redmine_refresh_pending = true;
+    if (idx)
+        fprintf(stderr, "Opened wiki index of %u pages from %s\n", idx->ndocs,
+                redmine_wiki_index_path);
+}
+
+static void redmine_wiki_index_cleanup()
+{
+    wiki_index_close(atomic_exchange(&redmine_wiki_index, NULL));
+    free(redmine_wiki_index_path);
+    redmine_wiki_index_path = NULL;
+}
+
+static void wiki_query_add_word(const char* word, size_t len, void* userp)
+{
+    sds** words = userp;
+    for (int i = 0; i < stb_arr_len(*words); i++) {
+        if (sdslen((*words)[i]) == len && memcmp((*words)[i], word, len) == 0)
+            return;
+    }
+    if (stb_arr_len(*words) < REDMINE_WIKI_QUERY_MAX)
+        *stb_arr_add(*words) = sdsnewlen(word, len);
+}
+
+/* First term record that is not less than word */
+static uint32_t wiki_index_lower_bound(const WikiIndex* idx, const char* word, size_t len)
+{
+    uint32_t lo = 0;
+    uint32_t hi = idx->nterms;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        SnapshotReader r = wiki_index_reader(idx, idx->terms[mid]);
+        uint32_t tlen;
+        const char* term = wiki_get_bytes(&r, &tlen);
+        int cmp = memcmp(term, word, tlen < len ? tlen : len);
+        if (cmp < 0 || (cmp == 0 && tlen < len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int wiki_hit_compare(const void* a, const void* b)
+{
+    const WikiHit* x = a;
+    const WikiHit* y = b;
+    if (x->score != y->score)
+        return x->score < y->score ? 1 : -1;
+    return (x->doc > y->doc) - (x->doc < y->doc);
+}
+
+/* Rank the pages matching query, best first. project_id 0 searches all
+ * projects. Returns an stb_arr. */
+static WikiHit* wiki_index_search(const WikiIndex* idx, const char* query, int project_id,
+                                  bool all_words, bool titles_only)
+{
+    sds* words = NULL;
+    wiki_tokenize(query, wiki_query_add_word, &words);
+    int nwords = stb_arr_len(words);
+
+    WikiHit* hits = NULL;
+    double* scores = calloc(idx->ndocs ? idx->ndocs : 1, sizeof(double));
+    uint32_t* matched = calloc(idx->ndocs ? idx->ndocs : 1, sizeof(uint32_t));
+    if (!scores || !matched || nwords == 0)
+        goto done;
+
+    double avg = titles_only ? idx->avg_title_len : idx->avg_len;
+    for (int w = 0; w < nwords; w++) {
+        size_t wlen = sdslen(words[w]);
+        for (uint32_t t = wiki_index_lower_bound(idx, words[w], wlen); t < idx->nterms; t++) {
+            SnapshotReader r = wiki_index_reader(idx, idx->terms[t]);
+            uint32_t tlen;
+            const char* term = wiki_get_bytes(&r, &tlen);
+            if (tlen < wlen || memcmp(term, words[w], wlen) != 0)
+                break;
+            uint32_t df = snapshot_get_u32(&r);
+            uint32_t title_df = snapshot_get_u32(&r);
+            uint32_t size = snapshot_get_u32(&r);
+            if (titles_only)
+                df = title_df;
+            if (!r.ok || df == 0 || (size_t)(r.end - r.p) < size)
+                continue;
+
+            double idf = log(1.0 + (idx->ndocs - df + 0.5) / (df + 0.5));
+            SnapshotReader postings = { r.p, r.p + size, true };
+            uint32_t doc = 0;
+            while (postings.p < postings.end) {
+                doc += wiki_get_varint(&postings);
+                uint32_t tf = wiki_get_varint(&postings);
+                uint32_t title_tf = wiki_get_varint(&postings);
+                if (!postings.ok || doc >= idx->ndocs)
+                    break;
+
+                SnapshotReader d = wiki_index_reader(idx, idx->docs[doc]);
+                uint32_t doc_project = snapshot_get_u32(&d);
+                uint32_t len = snapshot_get_u32(&d);
+                uint32_t title_len = snapshot_get_u32(&d);
+                if (!d.ok || (project_id && (int)doc_project != project_id))
+                    continue;
+
+                double f = titles_only ? title_tf : tf + (double)WIKI_TITLE_BOOST * title_tf;
+                double dl = titles_only ? title_len : (double)len + title_len;
+                if (f == 0)
+                    continue;
+                double norm = WIKI_BM25_K1 * (1 - WIKI_BM25_B + WIKI_BM25_B * (avg > 0 ? dl / avg : 1));
+                scores[doc] += idf * f * (WIKI_BM25_K1 + 1) / (f + norm);
+                matched[doc] |= 1u << w;
+            }
+        }
+    }
+
+    uint32_t all = nwords == 32 ? UINT32_MAX : (1u << nwords) - 1;
+    for (uint32_t i = 0; i < idx->ndocs; i++) {
+        if (matched[i] && (!all_words || matched[i] == all)) {
+            WikiHit hit = { i, scores[i] };
+            *stb_arr_add(hits) = hit;
+        }
+    }
+    if (hits)
+        qsort(hits, stb_arr_len(hits), sizeof(WikiHit), wiki_hit_compare);
+
+done:
+    for (int i = 0; i < nwords; i++)
+        sdsfree(words[i]);
+    stb_arr_free(words);
+    free(scores);
+    free(matched);
+    return hits;
+}
+
+static sds format_wiki_hit(sds result, const WikiIndex* idx, const WikiHit* hit)
+{
+    SnapshotReader r = wiki_index_reader(idx, idx->docs[hit->doc]);
+    uint32_t project_len, title_len, updated_on_len, excerpt_len;
+    snapshot_get_u32(&r);
+    snapshot_get_u32(&r);
+    snapshot_get_u32(&r);
+    const char* project = wiki_get_bytes(&r, &project_len);
+    const char* title = wiki_get_bytes(&r, &title_len);
+    wiki_get_bytes(&r, &updated_on_len);
+    const char* excerpt = wiki_get_bytes(&r, &excerpt_len);
+    if (!r.ok)
+        return result;
+    return sdscatprintf(result,
+        "Title: %.*s\n"
+        "Project: %.*s\n"
+        "Description: %.*s\n",
+        (int)title_len, title,
+        (int)project_len, project,
+        (int)excerpt_len, excerpt);
+}
+
+static void* redmine_refresh_main(void* arg)
+{
+    (void)arg;
+
+    /* Projects and versions take one request per project, so load them
+     * right away instead of on the first tool call */
+    if (redmine_snapshot_restored) {
+        redmine_user_id_init();
+    } else if (redmine_preload) {
+        meta_get(&redmine_metadata.projects);
+        meta_get(&redmine_metadata.versions);
+    }
+    if (atomic_exchange(&redmine_snapshot_dirty, false))
+        redmine_snapshot_save();
+
+    pthread_mutex_lock(&redmine_refresh_lock);
+    while (!redmine_refresh_stop) {
+        while (!redmine_refresh_pending && !redmine_refresh_stop)
+            pthread_cond_wait(&redmine_refresh_cond, &redmine_refresh_lock);
+        redmine_refresh_pending = false;
+        pthread_mutex_unlock(&redmine_refresh_lock);
+
+        for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++) {
+            MetaCollection* c = redmine_collections[i];
+            if (!atomic_load(&c->stale))
+                continue;
+            pthread_mutex_lock(&c->lock);
+            meta_reload(c);
+            pthread_mutex_unlock(&c->lock);
+        }
+        if (atomic_load(&redmine_wiki_index_stale))
+            redmine_wiki_index_refresh();
+        if (atomic_exchange(&redmine_snapshot_dirty, false))
+            redmine_snapshot_save();
+
+        pthread_mutex_lock(&redmine_refresh_lock);
+    }
+    pthread_mutex_unlock(&redmine_refresh_lock);
+    return NULL;
+}
+
+static void redmine_metadata_init()
+{
+    const char* preload = getenv("REDMINE_PRELOAD");
+    redmine_preload = !(preload && strcmp(preload, "0") == 0);
+
+    const char* ttl = getenv("REDMINE_METADATA_TTL");
+    if (ttl) {
+        int seconds = atoi(ttl);
+        if (seconds < REDMINE_METADATA_TTL_MIN)
+            seconds = REDMINE_METADATA_TTL_MIN;
+        for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++)
+            redmine_collections[i]->ttl = seconds;
+    }
+
+    redmine_snapshot_path_init();
+    redmine_snapshot_restore();
+    redmine_wiki_index_init();
+
+    if (pthread_create(&redmine_refresh_thread, NULL, redmine_refresh_main, NULL) == 0)
+        redmine_refresh_running = true;
+}
+
+static void redmine_metadata_cleanup()
+{
+    if (redmine_refresh_running) {
+        pthread_mutex_lock(&redmine_refresh_lock);
+        redmine_refresh_stop = true;
+        pthread_cond_signal(&redmine_refresh_cond);
+        pthread_mutex_unlock(&redmine_refresh_lock);
+        pthread_join(redmine_refresh_thread, NULL);
+        redmine_refresh_running = false;
+    }
+
+    redmine_retired_free(redmine_retired);
+    redmine_retired = NULL;
+    for (size_t i = 0; i < REDMINE_COLLECTIONS_LEN; i++)
+        meta_cleanup(redmine_collections[i]);
+    redmine_wiki_index_cleanup();
+    free(redmine_snapshot_path);
+    redmine_snapshot_path = NULL;
+}
+
+/*
+ * Journal cache
+ *
+ * Journals only change together with the issue, so they are kept per issue
+ * id and reused as long as the issue's updated_on still matches.
+ */
+
+#define REDMINE_JOURNAL_CACHE_MAX 4096
+
+typedef struct JournalCacheEntry {
+    char* updated_on;
+    cJSON* journals;
+} JournalCacheEntry;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-value"
+stb_declare_hash(STB_noprefix, JournalCache, journal_cache_, int, JournalCacheEntry*)
+stb_define_hash_vnull(JournalCache, journal_cache_, int, INT_MIN, INT_MIN + 1,
+                      return stb_hash_number((unsigned int)k);,
+                      JournalCacheEntry*, NULL)
+#pragma GCC diagnostic pop
+
+static JournalCache* redmine_journal_cache = NULL;
+
+static void journal_cache_entry_free(JournalCacheEntry* e)
+{
+    free(e->updated_on);
+    cJSON_Delete(e->journals);
+    free(e);
+}
+
+static void redmine_journals_cleanup()
+{
+    if (!redmine_journal_cache) return;
+    for (int i = 0; i < redmine_journal_cache->limit; i++) {
+        int k = redmine_journal_cache->table[i].k;
+        if (k == INT_MIN || k == INT_MIN + 1) continue;
+        journal_cache_entry_free(redmine_journal_cache->table[i].v);
+    }
+    journal_cache_destroy(redmine_journal_cache);
+    redmine_journal_cache = NULL;
+}
+
+/* Returns the cached journals of an issue, NULL if missing or stale. The
+ * array stays owned by the cache. */
+static cJSON* redmine_journals_lookup(int issue_id, const char* updated_on)
+{
+    if (!redmine_journal_cache || !updated_on)
+        return NULL;
+    JournalCacheEntry* e = journal_cache_get(redmine_journal_cache, issue_id);
+    if (!e || strcmp(e->updated_on, updated_on) != 0)
+        return NULL;
+    return e->journals;
+}
+
+/* Takes ownership of journals */
+static void redmine_journals_store(int issue_id, const char* updated_on, cJSON* journals)
+{
+    if (!redmine_journal_cache)
+        redmine_journal_cache = journal_cache_create();
+
+    JournalCacheEntry* e = malloc(sizeof(*e));
+    e->updated_on = strdup(updated_on);
+    e->journals = journals;
+
+    JournalCacheEntry* old = NULL;
+    if (journal_cache_remove(redmine_journal_cache, issue_id, &old))
+        journal_cache_entry_free(old);
+    journal_cache_add(redmine_journal_cache, issue_id, e);
+}
+
+/*
+ * Writes
+ *
+ * create_issue, add_issue_note and create_time_entry post through
+ * redmine_write(). With REDMINE_WRITE_QUEUE set, a write is appended to a
+ * journal file instead and acknowledged right away with a ticket. Worker
+ * threads post queued writes, REDMINE_WRITE_PARALLEL at a time. Notes on
+ * the same issue are posted in the order they were queued.
+ *
+ * Posts create records, so they are only retried, with backoff, when the
+ * server cannot have acted on them: the connection was never made, or the
+ * server answered 429, or 503 with Retry-After. A write that fails any other
+ * way after it was sent, a timeout or another server error, is not posted
+ * again but marked unknown, to be checked in Redmine.
+ *
+ * The journal is replayed at startup, so writes still queued at exit are
+ * posted by the next process. Each attempt is journaled before it starts,
+ * and a write that was in flight when the process died is marked unknown
+ * instead of being posted twice. get_write_status reports the outcome of
+ * each ticket.
+ */
+
+#define REDMINE_WRITE_PARALLEL 4
+/* Writes beyond this are refused until the queue drains */
+#define REDMINE_WRITE_QUEUE_MAX 256
+/* Finished writes whose outcome is kept for get_write_status */
+#define REDMINE_WRITE_HISTORY 512
+#define REDMINE_WRITE_ATTEMPTS 6
+#define REDMINE_WRITE_BACKOFF_MAX 60
+
+typedef enum {
+    REDMINE_WRITE_ISSUE,
+    REDMINE_WRITE_ISSUE_NOTE,
+    REDMINE_WRITE_TIME_ENTRY,
+} RedmineWriteKindEnum;
+
+typedef struct {
+    const char* name;
+    const char* failure;    /* text when the post fails without details */
+    bool ordered;           /* post in queue order per path */
+    void (*format)(cJSON* response, int ref, sds* result);
+} RedmineWriteKind;
+
+typedef enum {
+    REDMINE_WRITE_OK,
+    REDMINE_WRITE_REJECTED,
+    REDMINE_WRITE_RETRY,    /* not acted on by the server, safe to post again */
+    REDMINE_WRITE_UNKNOWN,  /* sent, but the outcome is not known */
+} RedmineWriteOutcome;
+
+typedef enum {
+    WRITE_PENDING,
+    WRITE_RUNNING,
+    WRITE_DONE,
+    WRITE_FAILED,
+    WRITE_UNKNOWN,
+} WriteState;
+
+static const char* const write_state_names[] = { "pending", "running", "done", "failed", "unknown" };
+
+#define WRITE_STATES_LEN (sizeof(write_state_names) / sizeof(write_state_names[0]))
+
+typedef struct {
+    int ticket;
+    RedmineWriteKindEnum kind;
+    int ref;                /* issue id of a note */
+    int attempts;
+    WriteState state;
+    time_t created_at;
+    time_t retry_at;
+    char* path;
+    char* data;
+    char* result;           /* outcome text once finished */
+} WriteEntry;
+
+static void format_issue_created(cJSON* json, int ref, sds* result)
+{
+    (void)ref;
+    cJSON* id = cJSON_Select(json, ".issue.id:n");
+    if (id)
+        *result = sdscatprintf(*result, "Issue #%d created successfully\n", id->valueint);
+}
+
+static void format_note_added(cJSON* json, int ref, sds* result)
+{
+    (void)json;
+    *result = sdscatprintf(*result, "Note added to issue #%d\n", ref);
+}
+
+static void format_time_entry_created(cJSON* json, int ref, sds* result)
+{
+    (void)ref;
+    cJSON* id = cJSON_Select(json, ".time_entry.id:n");
+    if (id)
+        *result = sdscatprintf(*result, "Time entry #%d created successfully\n", id->valueint);
+}
+
+static const RedmineWriteKind redmine_write_kinds[] = {
+    [REDMINE_WRITE_ISSUE] = { "create_issue", "Failed to create issue", false, format_issue_created },
+    [REDMINE_WRITE_ISSUE_NOTE] = { "add_issue_note", "Failed to add note to issue", true, format_note_added },
+    [REDMINE_WRITE_TIME_ENTRY] = { "create_time_entry", "Failed to create time entry", false, format_time_entry_created },
+};
+
+#define REDMINE_WRITE_KINDS_LEN (sizeof(redmine_write_kinds) / sizeof(redmine_write_kinds[0]))
+
+static char* redmine_write_journal_path = NULL;
+static int redmine_write_journal_fd = -1;
+static int redmine_write_journal_records = 0;
+static WriteEntry** redmine_writes = NULL;     /* stb_arr, by ticket */
+static int redmine_write_next_ticket = 1;
+static bool redmine_write_stop = false;
+static pthread_t redmine_write_threads[REDMINE_WRITE_PARALLEL];
+static int redmine_write_nthreads = 0;
+static pthread_mutex_t redmine_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t redmine_write_cond = PTHREAD_COND_INITIALIZER;
+
+static bool write_entry_finished(const WriteEntry* e)
+{
+    return e->state == WRITE_DONE || e->state == WRITE_FAILED || e->state == WRITE_UNKNOWN;
+}
+
+/* Post a write and describe the outcome in result, the way the tool reports
+ * it. *retry_after is the delay the server asked for, 0 if none. */
+static RedmineWriteOutcome redmine_write_post(RedmineWriteKindEnum kind, const char* path,
+                                              const char* data, int ref, sds* result,
+                                              long* retry_after)
+{
+    long status = 0;
+    bool sent = false;
+    cJSON* json = redmine_post(path, data, &status, &sent, retry_after);
+    cJSON* errors = cJSON_Select(json, ".errors:a");
+
+    RedmineWriteOutcome outcome;
+    if (errors) {
+        cJSON* error = NULL;
+        cJSON_ArrayForEach(error, errors) {
+            *result = sdscatfmt(*result, "%s\n", error->valuestring ? error->valuestring : "");
+        }
+        outcome = REDMINE_WRITE_REJECTED;
+    } else if (status >= 200 && status < 300) {
+        redmine_write_kinds[kind].format(json, ref, result);
+        outcome = REDMINE_WRITE_OK;
+    } else {
+        *result = sdscat(*result, redmine_write_kinds[kind].failure);
+        if (!sent || status == 429 || (status == 503 && *retry_after > 0)) {
+            outcome = REDMINE_WRITE_RETRY;
+        } else if (status == 0 || status >= 500) {
+            *result = sdscat(*result, ", it may have been applied anyway: check Redmine before trying again");
+            outcome = REDMINE_WRITE_UNKNOWN;
+        } else {
+            outcome = REDMINE_WRITE_REJECTED;
+        }
+    }
+
+    cJSON_Delete(json);
+    return outcome;
+}
+
+static void write_entry_free(WriteEntry* e)
+{
+    free(e->path);
+    free(e->data);
+    free(e->result);
+    free(e);
+}
+
+static cJSON* write_entry_queued_record(const WriteEntry* e)
+{
+    cJSON* record = cJSON_CreateObject();
+    cJSON_AddNumberToObject(record, "ticket", e->ticket);
+    cJSON_AddStringToObject(record, "kind", redmine_write_kinds[e->kind].name);
+    cJSON_AddNumberToObject(record, "ref", e->ref);
+    cJSON_AddNumberToObject(record, "created_at", (double)e->created_at);
+    cJSON_AddStringToObject(record, "path", e->path);
+    cJSON_AddStringToObject(record, "data", e->data);
+    return record;
 }
 
-static void redmine_trackers_cleanup()
+static cJSON* write_entry_finished_record(const WriteEntry* e)
 {
-    if (!redmine_trackers_instance) return;
-    for (int i = 0; i < stb_arr_len(redmine_trackers_instance); i++)
-        free(redmine_trackers_instance[i].name);
-    stb_arr_free(redmine_trackers_instance);
+    cJSON* record = cJSON_CreateObject();
+    cJSON_AddNumberToObject(record, "ticket", e->ticket);
+    cJSON_AddStringToObject(record, "state", write_state_names[e->state]);
+    cJSON_AddNumberToObject(record, "attempts", e->attempts);
+    cJSON_AddStringToObject(record, "result", e->result ? e->result : "");
+    return record;
 }
 
-/*
- * Projects
- */
-
-typedef struct {
-    int id;
-    char* name;
-    char* identifier;
-    char* description;
-} Project;
-
-static Project* redmine_projects_instance = NULL;
+/* Append one line to the journal and sync it. Takes ownership of record.
+ * Called with redmine_write_lock held. */
+static bool redmine_write_journal_append(cJSON* record)
+{
+    char* line = cJSON_PrintUnformatted(record);
+    cJSON_Delete(record);
+    if (!line)
+        return false;
+
+    sds buf = sdscat(sdsnew(line), "\n");
+    free(line);
+    bool ok = write(redmine_write_journal_fd, buf, sdslen(buf)) == (ssize_t)sdslen(buf)
+              && fdatasync(redmine_write_journal_fd) == 0;
+    sdsfree(buf);
+    redmine_write_journal_records++;
+    return ok;
+}
 
-static Project* redmine_projects_get()
+/* Rewrite the journal with only the writes still known. Called with
+ * redmine_write_lock held. */
+static void redmine_write_journal_compact()
 {
-    if (redmine_projects_instance)
-        return redmine_projects_instance;
+    sds out = sdsempty();
+    int records = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        WriteEntry* e = redmine_writes[i];
+        cJSON* record = write_entry_queued_record(e);
+        char* line = cJSON_PrintUnformatted(record);
+        cJSON_Delete(record);
+        out = sdscatprintf(out, "%s\n", line);
+        free(line);
+        records++;
+
+        /* Writes in flight keep their record, or a crash would repost them */
+        if (write_entry_finished(e) || e->state == WRITE_RUNNING) {
+            record = write_entry_finished_record(e);
+            line = cJSON_PrintUnformatted(record);
+            cJSON_Delete(record);
+            out = sdscatprintf(out, "%s\n", line);
+            free(line);
+            records++;
+        }
+    }
 
-    cJSON* json = redmine_get("projects.json");
-    if (!json)
-        return NULL;
+    sds tmp = sdscatprintf(sdsempty(), "%s.%d", redmine_write_journal_path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd >= 0) {
+        bool ok = write(fd, out, sdslen(out)) == (ssize_t)sdslen(out) && fdatasync(fd) == 0;
+        if (ok && rename(tmp, redmine_write_journal_path) == 0) {
+            if (redmine_write_journal_fd >= 0)
+                close(redmine_write_journal_fd);
+            redmine_write_journal_fd = fd;
+            redmine_write_journal_records = records;
+        } else {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    sdsfree(tmp);
+    sdsfree(out);
+}
 
-    cJSON* projects = cJSON_Select(json, ".projects:a");
-    if (!projects) {
-        cJSON_Delete(json);
-        return NULL;
+/* Forget the oldest finished writes beyond REDMINE_WRITE_HISTORY. Called
+ * with redmine_write_lock held. */
+static void redmine_write_trim()
+{
+    int finished = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        finished += write_entry_finished(redmine_writes[i]);
     }
 
-    cJSON* project = NULL;
-    cJSON_ArrayForEach(project, projects) {
-        cJSON* id = cJSON_Select(project, ".id:n");
-        cJSON* name = cJSON_Select(project, ".name:s");
-        cJSON* identifier = cJSON_Select(project, ".identifier:s");
-        cJSON* description = cJSON_Select(project, ".description:s");
-        if (id && name && identifier) {
-            Project p;
-            p.id = id->valueint;
-            p.name = strdup(name->valuestring);
-            p.identifier = strdup(identifier->valuestring);
-            p.description = description ? strdup(description->valuestring) : NULL;
-            *stb_arr_add(redmine_projects_instance) = p;
+    int excess = finished - REDMINE_WRITE_HISTORY;
+    int kept = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        WriteEntry* e = redmine_writes[i];
+        if (excess > 0 && write_entry_finished(e)) {
+            write_entry_free(e);
+            excess--;
+        } else {
+            redmine_writes[kept++] = e;
         }
     }
+    if (redmine_writes)
+        stb_arr_setlen(redmine_writes, kept);
 
-    cJSON_Delete(json);
-    return redmine_projects_instance;
+    if (redmine_write_journal_records > 4 * REDMINE_WRITE_HISTORY)
+        redmine_write_journal_compact();
 }
 
-static void redmine_projects_cleanup()
+/* Next write a worker may post, NULL if none is due. Sets *wake_at to when
+ * the next retry is due. Called with redmine_write_lock held. */
+static WriteEntry* redmine_write_next(time_t now, time_t* wake_at)
 {
-    if (!redmine_projects_instance) return;
-    for (int i = 0; i < stb_arr_len(redmine_projects_instance); i++) {
-        free(redmine_projects_instance[i].name);
-        free(redmine_projects_instance[i].identifier);
-        if (redmine_projects_instance[i].description)
-            free(redmine_projects_instance[i].description);
+    *wake_at = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        WriteEntry* e = redmine_writes[i];
+        if (e->state != WRITE_PENDING)
+            continue;
+
+        /* Wait for earlier writes to the same path */
+        bool blocked = false;
+        if (redmine_write_kinds[e->kind].ordered) {
+            for (int k = 0; k < i && !blocked; k++) {
+                WriteEntry* prev = redmine_writes[k];
+                blocked = (prev->state == WRITE_PENDING || prev->state == WRITE_RUNNING)
+                          && strcmp(prev->path, e->path) == 0;
+            }
+        }
+        if (blocked)
+            continue;
+
+        if (e->retry_at <= now)
+            return e;
+        if (*wake_at == 0 || e->retry_at < *wake_at)
+            *wake_at = e->retry_at;
     }
-    stb_arr_free(redmine_projects_instance);
+    return NULL;
 }
 
-/*
- * Versions
- */
+static void* redmine_write_main(void* arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&redmine_write_lock);
+    while (!redmine_write_stop) {
+        time_t wake_at;
+        WriteEntry* e = redmine_write_next(time(NULL), &wake_at);
+        if (!e) {
+            if (wake_at) {
+                struct timespec ts = { wake_at, 0 };
+                pthread_cond_timedwait(&redmine_write_cond, &redmine_write_lock, &ts);
+            } else {
+                pthread_cond_wait(&redmine_write_cond, &redmine_write_lock);
+            }
+            continue;
+        }
 
-typedef struct {
-    int id;
-    char* name;
-    int project_id;
-} Version;
+        /* Journaled first, so a crash from here on is not posted again */
+        e->state = WRITE_RUNNING;
+        e->attempts++;
+        if (!redmine_write_journal_append(write_entry_finished_record(e))) {
+            e->state = WRITE_PENDING;
+            e->attempts--;
+            e->retry_at = time(NULL) + REDMINE_WRITE_BACKOFF_MAX;
+            continue;
+        }
+        pthread_mutex_unlock(&redmine_write_lock);
 
-static Version* redmine_versions_instance = NULL;
+        sds result = sdsempty();
+        long retry_after = 0;
+        RedmineWriteOutcome outcome = redmine_write_post(e->kind, e->path, e->data, e->ref,
+                                                         &result, &retry_after);
 
-static Version* redmine_versions_get()
+        pthread_mutex_lock(&redmine_write_lock);
+        free(e->result);
+        e->result = strdup(result);
+        sdsfree(result);
+
+        if (outcome == REDMINE_WRITE_RETRY && e->attempts < REDMINE_WRITE_ATTEMPTS) {
+            long backoff = retry_after > 0 ? retry_after : 1 << e->attempts;
+            e->retry_at = time(NULL) + (backoff < REDMINE_WRITE_BACKOFF_MAX ? backoff : REDMINE_WRITE_BACKOFF_MAX);
+            e->state = WRITE_PENDING;
+            redmine_write_journal_append(write_entry_finished_record(e));
+        } else {
+            e->state = outcome == REDMINE_WRITE_OK ? WRITE_DONE
+                     : outcome == REDMINE_WRITE_UNKNOWN ? WRITE_UNKNOWN : WRITE_FAILED;
+            redmine_write_journal_append(write_entry_finished_record(e));
+            fprintf(stderr, "Write #%d (%s) %s after %d attempt(s)\n", e->ticket,
+                    redmine_write_kinds[e->kind].name, write_state_names[e->state], e->attempts);
+            redmine_write_trim();
+        }
+        /* Writes waiting on this path may go now */
+        pthread_cond_broadcast(&redmine_write_cond);
+    }
+    pthread_mutex_unlock(&redmine_write_lock);
+    return NULL;
+}
+
+/* Queue a write, returns its ticket, 0 if it must be posted right away or
+ * -1 with *error set if it could not be queued. Posting it then would pass
+ * queued notes on the same issue, so the caller must fail instead. */
+static int redmine_write_enqueue(RedmineWriteKindEnum kind, const char* path, const char* data, int ref,
+                                 const char** error)
 {
-    if (redmine_versions_instance)
-        return redmine_versions_instance;
+    if (redmine_write_journal_fd < 0 || redmine_write_nthreads == 0)
+        return 0;
 
-    Project* redmine_projects = redmine_projects_get();
-    for (int i = 0; i < stb_arr_len(redmine_projects); i++) {
-        char path[256];
-        snprintf(path, sizeof(path), "projects/%d/versions.json", redmine_projects[i].id);
+    pthread_mutex_lock(&redmine_write_lock);
 
-        cJSON* json = redmine_get(path);
-        if (!json)
-            continue;
+    int pending = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        WriteState state = redmine_writes[i]->state;
+        pending += state == WRITE_PENDING || state == WRITE_RUNNING;
+    }
 
-        cJSON* versions = cJSON_Select(json, ".versions:a");
-        if (!versions) {
-            cJSON_Delete(json);
-            continue;
+    int ticket = -1;
+    if (pending >= REDMINE_WRITE_QUEUE_MAX) {
+        *error = "Write queue full, retry later";
+    } else {
+        WriteEntry* e = calloc(1, sizeof(*e));
+        e->ticket = redmine_write_next_ticket;
+        e->kind = kind;
+        e->ref = ref;
+        e->state = WRITE_PENDING;
+        e->created_at = time(NULL);
+        e->path = strdup(path);
+        e->data = strdup(data);
+
+        if (redmine_write_journal_append(write_entry_queued_record(e))) {
+            *stb_arr_add(redmine_writes) = e;
+            ticket = redmine_write_next_ticket++;
+            pthread_cond_signal(&redmine_write_cond);
+        } else {
+            *error = "Failed to write the write queue journal";
+            write_entry_free(e);
         }
+    }
 
-        cJSON* version = NULL;
-        cJSON_ArrayForEach(version, versions) {
-            cJSON* id = cJSON_Select(version, ".id:n");
-            cJSON* name = cJSON_Select(version, ".name:s");
-            if (id && name) {
-                Version v;
-                v.id = id->valueint;
-                v.name = strdup(name->valuestring);
-                v.project_id = redmine_projects[i].id;
-                *stb_arr_add(redmine_versions_instance) = v;
-            }
-        }
+    pthread_mutex_unlock(&redmine_write_lock);
+    return ticket;
+}
 
-        cJSON_Delete(json);
+/* Queue the write if the queue is on, post it right away otherwise */
+static McpToolCallResult* redmine_write(McpToolCallResult* r, RedmineWriteKindEnum kind,
+                                        const char* path, const char* data, int ref)
+{
+    const char* error = NULL;
+    int ticket = redmine_write_enqueue(kind, path, data, ref, &error);
+    if (ticket > 0) {
+        mcp_tool_call_result_add_textf(r,
+            "Queued as write #%d, use get_write_status to check the outcome\n", ticket);
+        return r;
+    }
+    if (ticket < 0) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, error);
+        return r;
     }
-    return redmine_versions_instance;
+
+    sds result = sdsempty();
+    long retry_after = 0;
+    if (redmine_write_post(kind, path, data, ref, &result, &retry_after) != REDMINE_WRITE_OK)
+        mcp_tool_call_result_set_error(r);
+    mcp_tool_call_result_add_text(r, result);
+    sdsfree(result);
+    return r;
 }
 
-static void redmine_versions_cleanup()
+static WriteEntry* redmine_write_find(int ticket)
 {
-    if (!redmine_versions_instance) return;
-    for (int i = 0; i < stb_arr_len(redmine_versions_instance); i++)
-        free(redmine_versions_instance[i].name);
-    stb_arr_free(redmine_versions_instance);
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        if (redmine_writes[i]->ticket == ticket)
+            return redmine_writes[i];
+    }
+    return NULL;
 }
 
-/*
- * Time entry activities
- */
+/* Rebuild the queue from the journal, called before the workers start */
+static void redmine_write_journal_replay()
+{
+    FILE* f = fopen(redmine_write_journal_path, "r");
+    if (!f)
+        return;
 
-typedef struct {
-    int id;
-    char* name;
-} TimeEntryActivity;
+    char* line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, f) > 0) {
+        cJSON* record = cJSON_Parse(line);
+        cJSON* ticket = cJSON_Select(record, ".ticket:n");
+        cJSON* kind = cJSON_Select(record, ".kind:s");
+        cJSON* state = cJSON_Select(record, ".state:s");
+        if (ticket && ticket->valueint >= redmine_write_next_ticket)
+            redmine_write_next_ticket = ticket->valueint + 1;
+
+        if (ticket && kind) {
+            cJSON* ref = cJSON_Select(record, ".ref:n");
+            cJSON* created_at = cJSON_Select(record, ".created_at:n");
+            cJSON* path = cJSON_Select(record, ".path:s");
+            cJSON* data = cJSON_Select(record, ".data:s");
+            size_t k = 0;
+            while (k < REDMINE_WRITE_KINDS_LEN && strcmp(redmine_write_kinds[k].name, kind->valuestring) != 0)
+                k++;
+            if (k < REDMINE_WRITE_KINDS_LEN && path && data && !redmine_write_find(ticket->valueint)) {
+                WriteEntry* e = calloc(1, sizeof(*e));
+                e->ticket = ticket->valueint;
+                e->kind = k;
+                e->ref = ref ? ref->valueint : 0;
+                e->state = WRITE_PENDING;
+                e->created_at = created_at ? (time_t)created_at->valuedouble : time(NULL);
+                e->path = strdup(path->valuestring);
+                e->data = strdup(data->valuestring);
+                *stb_arr_add(redmine_writes) = e;
+            }
+        } else if (ticket && state) {
+            WriteEntry* e = redmine_write_find(ticket->valueint);
+            cJSON* attempts = cJSON_Select(record, ".attempts:n");
+            cJSON* result = cJSON_Select(record, ".result:s");
+            size_t k = 0;
+            while (k < WRITE_STATES_LEN && strcmp(write_state_names[k], state->valuestring) != 0)
+                k++;
+            if (e && k < WRITE_STATES_LEN) {
+                e->state = k;
+                e->attempts = attempts ? attempts->valueint : 0;
+                free(e->result);
+                e->result = result ? strdup(result->valuestring) : NULL;
+            }
+        }
+        cJSON_Delete(record);
+    }
+    free(line);
+    fclose(f);
 
-static TimeEntryActivity* redmine_time_entry_activities_instance = NULL;
+    /* Posted when the last process died, it may or may not have been applied */
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+        WriteEntry* e = redmine_writes[i];
+        if (e->state != WRITE_RUNNING)
+            continue;
+        e->state = WRITE_UNKNOWN;
+        free(e->result);
+        e->result = strdup("Interrupted while being posted, it may have been applied: "
+                           "check Redmine before trying again");
+    }
+}
 
-static TimeEntryActivity* redmine_time_entry_activities_get()
+static void redmine_write_queue_init()
 {
-    if (redmine_time_entry_activities_instance)
-        return redmine_time_entry_activities_instance;
-
-    cJSON* json = redmine_get("enumerations/time_entry_activities.json");
-    if (!json)
-        return NULL;
+    const char* path = getenv("REDMINE_WRITE_QUEUE");
+    if (!path || !*path || strcmp(path, "0") == 0)
+        return;
+    redmine_write_journal_path = strcmp(path, "1") == 0 ? redmine_cache_path("writes") : strdup(path);
+    if (!redmine_write_journal_path)
+        return;
 
-    cJSON* activities = cJSON_Select(json, ".time_entry_activities:a");
-    if (!activities) {
-        cJSON_Delete(json);
-        return NULL;
+    pthread_mutex_lock(&redmine_write_lock);
+    redmine_write_journal_replay();
+    redmine_write_trim();
+    redmine_write_journal_compact();
+    pthread_mutex_unlock(&redmine_write_lock);
+    if (redmine_write_journal_fd < 0) {
+        fprintf(stderr, "Cannot write %s, writes are not queued\n", redmine_write_journal_path);
+        return;
     }
 
-    cJSON* activity = NULL;
-    cJSON_ArrayForEach(activity, activities) {
-        cJSON* id = cJSON_Select(activity, ".id:n");
-        cJSON* name = cJSON_Select(activity, ".name:s");
-        if (id && name) {
-            TimeEntryActivity t;
-            t.id = id->valueint;
-            t.name = strdup(name->valuestring);
-            *stb_arr_add(redmine_time_entry_activities_instance) = t;
-        }
+    int pending = 0;
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++)
+        pending += redmine_writes[i]->state == WRITE_PENDING;
+    if (pending > 0)
+        fprintf(stderr, "Resuming %d queued write(s)\n", pending);
+
+    for (int i = 0; i < REDMINE_WRITE_PARALLEL; i++) {
+        if (pthread_create(&redmine_write_threads[i], NULL, redmine_write_main, NULL) != 0)
+            break;
+        redmine_write_nthreads++;
     }
+}
 
-    cJSON_Delete(json);
-    return redmine_time_entry_activities_instance;
+/* Writes still queued stay in the journal for the next start */
+static void redmine_write_queue_cleanup()
+{
+    pthread_mutex_lock(&redmine_write_lock);
+    redmine_write_stop = true;
+    pthread_cond_broadcast(&redmine_write_cond);
+    pthread_mutex_unlock(&redmine_write_lock);
+    for (int i = 0; i < redmine_write_nthreads; i++)
+        pthread_join(redmine_write_threads[i], NULL);
+    redmine_write_nthreads = 0;
+
+    for (int i = 0; i < stb_arr_len(redmine_writes); i++)
+        write_entry_free(redmine_writes[i]);
+    stb_arr_free(redmine_writes);
+    redmine_writes = NULL;
+    if (redmine_write_journal_fd >= 0)
+        close(redmine_write_journal_fd);
+    redmine_write_journal_fd = -1;
+    free(redmine_write_journal_path);
+    redmine_write_journal_path = NULL;
 }
 
-static void redmine_time_entry_activities_cleanup()
+/* Transfers for a cancelled tool call are aborted, and time out no later
+ * than the call does */
+static bool redmine_call_cancelled()
 {
-    if (!redmine_time_entry_activities_instance) return;
-    for (int i = 0; i < stb_arr_len(redmine_time_entry_activities_instance); i++)
-        free(redmine_time_entry_activities_instance[i].name);
-    stb_arr_free(redmine_time_entry_activities_instance);
+    return mcp_call_cancelled(NULL);
 }
 
-static const char* redmine_version_id_to_name(int id)
+static long redmine_call_remaining_ms()
 {
-    Version* redmine_versions = redmine_versions_get();
-    for (int i = 0; i < stb_arr_len(redmine_versions); i++) {
-        if (redmine_versions[i].id == id)
-            return redmine_versions[i].name;
-    }
-    return NULL;
+    return mcp_call_remaining_ms(NULL);
+}
+
+/* Batches fetched for a tool call, like the issue details behind
+ * list_activities, report their progress to the client */
+static void redmine_batch_progress(int done, int n)
+{
+    if (!mcp_call_wants_progress(NULL))
+        return;
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Fetched %d of %d", done, n);
+    mcp_call_progress(NULL, done, n, msg);
 }
 
 static void redmine_init()
 {
     redmine_base_url = getenv("REDMINE_URL");
     redmine_api_key = getenv("REDMINE_API_KEY");
-    redmine_user_id_init();
+
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "X-Redmine-API-Key: %s", redmine_api_key);
+    redmine_auth_headers = curl_slist_append(NULL, auth_header);
+    http_set_abort_check(redmine_call_cancelled);
+    http_set_time_budget(redmine_call_remaining_ms);
+    http_set_batch_progress(redmine_batch_progress);
+    mcp_set_call_hooks(redmine_call_enter, redmine_call_leave);
+
+    const char* max_inline = getenv("REDMINE_MAX_INLINE_SIZE");
+    mcp_set_max_inline_size(max_inline ? strtoull(max_inline, NULL, 10)
+                                       : REDMINE_MAX_INLINE_SIZE);
+
+    double start = redmine_now_ms();
+    redmine_metadata_init();
+    if (!redmine_snapshot_restored)
+        redmine_user_id_init();
+    redmine_write_queue_init();
+    fprintf(stderr, "Startup took %.0f ms\n", redmine_now_ms() - start);
 }
 
 static void redmine_cleanup()
 {
-    redmine_trackers_cleanup();
-    redmine_versions_cleanup();
-    redmine_projects_cleanup();
-    redmine_issue_statuses_cleanup();
-    redmine_time_entry_activities_cleanup();
+    redmine_write_queue_cleanup();
+    redmine_metadata_cleanup();
+    redmine_journals_cleanup();
+    curl_slist_free_all(redmine_auth_headers);
 }
 
 /*
@@ -631,7 +3039,7 @@ static McpToolCallResult* list_activities_handler(cJSON* params)
 
     static const char* const fmt = "%Y-%m-%d";
     struct tm start_date_tm;
-    cJSON* start_date_param = cJSON_Select(params, "start_date:s");
+    cJSON* start_date_param = cJSON_Select(params, ".start_date:s");
     if (!start_date_param || strptime(start_date_param->valuestring, fmt, &start_date_tm) == NULL) {
         /* default to 2 weeks ago */
         time_t now = time(NULL);
@@ -667,20 +3075,76 @@ static McpToolCallResult* list_activities_handler(cJSON* params)
         return r;
     }
 
-    cJSON** activities = NULL;
+    /* Collect journals of every issue, fetching details only for issues
+     * that changed since they were last seen, several at a time */
+
+    if (redmine_journal_cache && redmine_journal_cache->count > REDMINE_JOURNAL_CACHE_MAX)
+        redmine_journals_cleanup();
+
+    int nissues = cJSON_GetArraySize(issues);
+    cJSON** issue_journals = calloc(nissues > 0 ? nissues : 1, sizeof(cJSON*));
+    cJSON** uncached = NULL;
+    HttpRequest* reqs = NULL;
+    int* req_issue = NULL;
+
+    int n = 0;
     cJSON* issue = NULL;
     cJSON_ArrayForEach(issue, issues) {
+        int i = n++;
         cJSON* id = cJSON_Select(issue, ".id:n");
         cJSON* subject = cJSON_Select(issue, ".subject:s");
+        cJSON* issue_updated_on = cJSON_Select(issue, ".updated_on:s");
         if (!id || !subject) continue;
 
-        int issue_id = id->valueint;
+        issue_journals[i] = redmine_journals_lookup(id->valueint,
+            issue_updated_on ? issue_updated_on->valuestring : NULL);
+        if (issue_journals[i]) continue;
+
         char detail_path[256];
-        snprintf(detail_path, sizeof(detail_path), "issues/%d.json?include=journals", issue_id);
-        cJSON* detail_json = redmine_get(detail_path);
+        snprintf(detail_path, sizeof(detail_path), "issues/%d.json?include=journals", id->valueint);
+        char url[512];
+        redmine_url(url, sizeof(url), detail_path);
+
+        HttpRequest* req = stb_arr_add(reqs);
+        req->url = strdup(url);
+        *stb_arr_add(req_issue) = i;
+    }
+
+    http_get_json_many(reqs, stb_arr_len(reqs), redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    for (int k = 0; k < stb_arr_len(reqs); k++) {
+        int i = req_issue[k];
+        cJSON* detail_json = reqs[k].json;
+        free((char*)reqs[k].url);
         if (!detail_json) continue;
 
+        cJSON* detail_issue = cJSON_Select(detail_json, ".issue:o");
         cJSON* journals = cJSON_Select(detail_json, ".issue.journals:a");
+        journals = journals ? cJSON_DetachItemViaPointer(detail_issue, journals)
+                            : cJSON_CreateArray();
+        cJSON_Delete(detail_json);
+
+        cJSON* listed = cJSON_GetArrayItem(issues, i);
+        cJSON* id = cJSON_Select(listed, ".id:n");
+        cJSON* issue_updated_on = cJSON_Select(listed, ".updated_on:s");
+        if (issue_updated_on)
+            redmine_journals_store(id->valueint, issue_updated_on->valuestring, journals);
+        else
+            *stb_arr_add(uncached) = journals;
+        issue_journals[i] = journals;
+    }
+    stb_arr_free(reqs);
+    stb_arr_free(req_issue);
+
+    cJSON** activities = NULL;
+    n = 0;
+    cJSON_ArrayForEach(issue, issues) {
+        cJSON* journals = issue_journals[n++];
+        if (!journals) continue;
+
+        int issue_id = cJSON_Select(issue, ".id:n")->valueint;
+        cJSON* subject = cJSON_Select(issue, ".subject:s");
+
         cJSON* journal = NULL;
         cJSON_ArrayForEach(journal, journals) {
             cJSON* journal_user_id = cJSON_Select(journal, ".user.id:n");
@@ -700,10 +3164,13 @@ static McpToolCallResult* list_activities_handler(cJSON* params)
                 }
             }
         }
-
-        cJSON_Delete(detail_json);
     }
 
+    for (int i = 0; i < stb_arr_len(uncached); i++)
+        cJSON_Delete(uncached[i]);
+    stb_arr_free(uncached);
+    free(issue_journals);
+
     cJSON_Delete(issues_json);
 
     if (stb_arr_len(activities) == 0) {
@@ -791,6 +3258,19 @@ static McpToolCallResult* list_activities_handler(cJSON* params)
     return r;
 }
 
+static void format_search_result(cJSON* item, void* userp)
+{
+    sds* result = userp;
+    cJSON* title = cJSON_Select(item, ".title:s");
+    cJSON* description = cJSON_Select(item, ".description:s");
+    if (!title || !description) return;
+    *result = sdscatprintf(*result,
+        "Title: %s\n"
+        "Description: %s\n",
+        title->valuestring,
+        description->valuestring);
+}
+
 static McpToolCallResult* search_wiki_handler(cJSON* params)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
@@ -837,11 +3317,29 @@ static McpToolCallResult* search_wiki_handler(cJSON* params)
         titles_only = 1;
     }
 
+    /* Answer from the local index once it is built. It only knows the
+     * projects in the metadata store, anything else goes to Redmine. */
+    WikiIndex* idx = redmine_wiki_index_get();
+    Project* project = project_identifier ? redmine_project_by_identifier(project_identifier) : NULL;
+    if (idx && (!project_identifier || project)) {
+        WikiHit* hits = wiki_index_search(idx, query, project ? project->id : 0,
+                                          all_words, titles_only);
+        int total = stb_arr_len(hits);
+        sds result = sdscatprintf(sdsempty(), "Total: %d\nOffset: %d\n", total, offset);
+        for (int i = offset; i < total && i < offset + limit; i++)
+            result = format_wiki_hit(result, idx, &hits[i]);
+        stb_arr_free(hits);
+
+        mcp_tool_call_result_add_text(r, result);
+        sdsfree(result);
+        return r;
+    }
+
     char* query_escaped = curl_easy_escape(NULL, query, 0);
     char search_path[512];
     int written = snprintf(search_path, sizeof(search_path),
-        "search.json?q=%s&wiki_pages=1&limit=%d&offset=%d&all_words=%d&titles_only=%d",
-        query_escaped, limit, offset, all_words, titles_only);
+        "search.json?q=%s&wiki_pages=1&all_words=%d&titles_only=%d",
+        query_escaped, all_words, titles_only);
 
     if (project_identifier) {
         char* project_escaped = curl_easy_escape(NULL, project_identifier, 0);
@@ -851,37 +3349,24 @@ static McpToolCallResult* search_wiki_handler(cJSON* params)
 
     curl_free(query_escaped);
 
-    cJSON* json = redmine_get(search_path);
-    if (!json) {
+    RedminePage page;
+    sds items = sdsempty();
+    if (!redmine_get_paged(search_path, "results", limit, offset, &page, format_search_result, &items)) {
+        sdsfree(items);
         mcp_tool_call_result_set_error(r);
         mcp_tool_call_result_add_text(r, "Failed to search wiki pages from Redmine");
         return r;
     }
 
     sds result = sdsempty();
-
-    cJSON* total_count = cJSON_Select(json, ".total_count:n");
-    if (total_count)
-        result = sdscatprintf(result, "Total: %d\n", total_count->valueint);
-
-    cJSON* off = cJSON_Select(json, ".offset:n");
-    if (off)
-        result = sdscatprintf(result, "Offset: %d\n", off->valueint);
-
-    cJSON* result_item = NULL;
-    cJSON* results = cJSON_Select(json, ".results:a");
-    cJSON_ArrayForEach(result_item, results) {
-        cJSON* title = cJSON_Select(result_item, ".title:s");
-        cJSON* description = cJSON_Select(result_item, ".description:s");
-        if (!title || !description) continue;
-        result = sdscatprintf(result,
-            "Title: %s\n"
-            "Description: %s\n",
-            title->valuestring,
-            description->valuestring);
-    }
-
-    cJSON_Delete(json);
+    if (page.total_count >= 0)
+        result = sdscatprintf(result, "Total: %d\n", page.total_count);
+    if (page.offset >= 0)
+        result = sdscatprintf(result, "Offset: %d\n", page.offset);
+    result = sdscatsds(result, items);
+    if (!page.complete)
+        result = sdscat(result, "(Failed to fetch further pages, results end here)\n");
+    sdsfree(items);
 
     mcp_tool_call_result_add_text(r, result);
     sdsfree(result);
@@ -920,7 +3405,7 @@ static McpInputSchema tool_search_wiki_schema[] = {
       .type = MCP_INPUT_SCHEMA_TYPE_STRING,
     },
     { .name = "limit",
-      .description = "Maximum number of results to return (optional, default: 25)",
+      .description = "Maximum number of results to return (optional, default: 25, more than 100 are fetched in pages)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
     },
     { .name = "offset",
@@ -962,38 +3447,9 @@ static McpTool tool_list_projects = {
     },
 };
 
-static McpToolCallResult* get_issue_handler(cJSON* params)
+/* Append the details of issue, with the discussion from journals if not NULL */
+static sds format_issue(sds result, cJSON* issue, int issue_id, cJSON* journals)
 {
-    McpToolCallResult* r = mcp_tool_call_result_create();
-    if (!r)
-        return NULL;
-
-    cJSON* issue_id_json = cJSON_Select(params, ".issue_id:n");
-    if (!issue_id_json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "issue_id parameter is required");
-        return r;
-    }
-
-    int issue_id = issue_id_json->valueint;
-    char path[128];
-    snprintf(path, sizeof(path), "issues/%d.json?include=journals", issue_id);
-
-    cJSON* json = redmine_get(path);
-    if (!json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to fetch issue from Redmine");
-        return r;
-    }
-
-    cJSON* issue = cJSON_Select(json, ".issue");
-    if (!issue) {
-        cJSON_Delete(json);
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Invalid issue response");
-        return r;
-    }
-
     cJSON* id = cJSON_Select(issue, ".id:n");
     cJSON* subject = cJSON_Select(issue, ".subject:s");
     cJSON* description = cJSON_Select(issue, ".description:s");
@@ -1006,7 +3462,6 @@ static McpToolCallResult* get_issue_handler(cJSON* params)
     cJSON* project = cJSON_Select(issue, ".project.name:s");
     cJSON* tracker = cJSON_Select(issue, ".tracker.name:s");
 
-    sds result = sdsempty();
     result = sdscatprintf(result, "Issue #%d\n", id ? id->valueint : issue_id);
     if (subject)
         result = sdscatprintf(result, "Subject: %s\n", subject->valuestring);
@@ -1031,7 +3486,6 @@ static McpToolCallResult* get_issue_handler(cJSON* params)
         result = sdscatprintf(result, "%s\n", description->valuestring);
     }
 
-    cJSON* journals = cJSON_Select(issue, ".journals:a");
     if (journals && cJSON_GetArraySize(journals) > 0) {
         result = sdscat(result, "Discussion History:\n");
 
@@ -1070,6 +3524,42 @@ static McpToolCallResult* get_issue_handler(cJSON* params)
     /*     result = sdscat(result, "\n"); */
     /* } */
 
+    return result;
+}
+
+static McpToolCallResult* get_issue_handler(cJSON* params)
+{
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    if (!r)
+        return NULL;
+
+    cJSON* issue_id_json = cJSON_Select(params, ".issue_id:n");
+    if (!issue_id_json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "issue_id parameter is required");
+        return r;
+    }
+
+    int issue_id = issue_id_json->valueint;
+    char path[128];
+    snprintf(path, sizeof(path), "issues/%d.json?include=journals", issue_id);
+
+    cJSON* json = redmine_get(path);
+    if (!json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Failed to fetch issue from Redmine");
+        return r;
+    }
+
+    cJSON* issue = cJSON_Select(json, ".issue");
+    if (!issue) {
+        cJSON_Delete(json);
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Invalid issue response");
+        return r;
+    }
+
+    sds result = format_issue(sdsempty(), issue, issue_id, cJSON_Select(issue, ".journals:a"));
     cJSON_Delete(json);
 
     mcp_tool_call_result_add_text(r, result);
@@ -1095,134 +3585,264 @@ static McpTool tool_get_issue = {
     },
 };
 
-static McpToolCallResult* list_issues_handler(cJSON* params)
+/* Most issues get_issues fetches per call, and ids per issues.json request */
+#define REDMINE_BATCH_MAX 500
+#define REDMINE_BATCH_LIST 100
+
+static McpToolCallResult* get_issues_handler(cJSON* params)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
     if (!r)
         return NULL;
 
-    int limit = 25;
-    cJSON* limit_json = cJSON_Select(params, ".limit:n");
-    if (limit_json) {
-        limit = limit_json->valueint;
-        if (limit < 1) limit = 25;
+    cJSON* ids_json = cJSON_Select(params, ".issue_ids:a");
+    if (!ids_json) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "issue_ids parameter is required");
+        return r;
     }
 
-    int offset = 0;
-    cJSON* offset_json = cJSON_Select(params, ".offset:n");
-    if (offset_json) {
-        offset = offset_json->valueint;
-        if (offset < 0) offset = 0;
+    /* Unique ids in the order given, position by id */
+    int* ids = NULL;
+    MetaIndex* positions = meta_index_create();
+    cJSON* id_json = NULL;
+    cJSON_ArrayForEach(id_json, ids_json) {
+        if (!cJSON_IsNumber(id_json) || meta_index_find(positions, id_json->valueint) >= 0)
+            continue;
+        meta_index_set(positions, id_json->valueint, stb_arr_len(ids));
+        *stb_arr_add(ids) = id_json->valueint;
     }
 
-    char** opts = NULL;
-    char buf[32];
+    int n = stb_arr_len(ids);
+    if (n == 0 || n > REDMINE_BATCH_MAX) {
+        stb_arr_free(ids);
+        meta_index_destroy(positions);
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_textf(r, "issue_ids must contain between 1 and %d issue ids",
+                                       REDMINE_BATCH_MAX);
+        return r;
+    }
 
-    cJSON* project_id_json = cJSON_Select(params, ".project_id:n");
-    if (project_id_json) {
-        snprintf(buf, sizeof(buf), "%d", project_id_json->valueint);
-        *stb_arr_add(opts) = "project_id";
-        *stb_arr_add(opts) = strdup(buf);
+    if (redmine_journal_cache && redmine_journal_cache->count > REDMINE_JOURNAL_CACHE_MAX)
+        redmine_journals_cleanup();
+
+    /* The issues themselves, REDMINE_BATCH_LIST per request */
+    int nlists = (n + REDMINE_BATCH_LIST - 1) / REDMINE_BATCH_LIST;
+    HttpRequest* lists = calloc(nlists, sizeof(HttpRequest));
+    for (int k = 0; k < nlists; k++) {
+        sds path = sdsnew("issues.json?issue_id=");
+        for (int i = k * REDMINE_BATCH_LIST; i < n && i < (k + 1) * REDMINE_BATCH_LIST; i++)
+            path = sdscatprintf(path, "%s%d", i % REDMINE_BATCH_LIST ? "," : "", ids[i]);
+        path = sdscatprintf(path, "&status_id=*&limit=%d", REDMINE_BATCH_LIST);
+        char url[4096];
+        redmine_url(url, sizeof(url), path);
+        lists[k].url = strdup(url);
+        sdsfree(path);
+    }
+    http_get_json_many(lists, nlists, redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    cJSON** issues = calloc(n, sizeof(cJSON*));
+    cJSON** journals = calloc(n, sizeof(cJSON*));
+    for (int k = 0; k < nlists; k++) {
+        cJSON* listed = cJSON_Select(lists[k].json, ".issues:a");
+        cJSON* issue = NULL;
+        cJSON_ArrayForEach(issue, listed) {
+            cJSON* id = cJSON_Select(issue, ".id:n");
+            int i = id ? meta_index_find(positions, id->valueint) : -1;
+            if (i >= 0)
+                issues[i] = issue;
+        }
     }
 
-    cJSON* status_id_json = cJSON_Select(params, ".status_id:s");
-    if (status_id_json) {
-        *stb_arr_add(opts) = "status_id";
-        *stb_arr_add(opts) = strdup(status_id_json->valuestring);
+    /* Journals only come with the single issue request: fetch those of
+     * issues that changed since they were cached, and of issues missing
+     * from the lists, several at a time */
+    HttpRequest* reqs = NULL;
+    int* req_issue = NULL;
+    for (int i = 0; i < n; i++) {
+        cJSON* updated_on = cJSON_Select(issues[i], ".updated_on:s");
+        journals[i] = redmine_journals_lookup(ids[i], updated_on ? updated_on->valuestring : NULL);
+        if (journals[i])
+            continue;
+
+        char path[128];
+        char url[512];
+        snprintf(path, sizeof(path), "issues/%d.json?include=journals", ids[i]);
+        redmine_url(url, sizeof(url), path);
+        HttpRequest* req = stb_arr_add(reqs);
+        req->url = strdup(url);
+        *stb_arr_add(req_issue) = i;
     }
 
-    cJSON* assigned_to_id_json = cJSON_Select(params, ".assigned_to_id:n");
-    if (assigned_to_id_json) {
-        snprintf(buf, sizeof(buf), "%d", assigned_to_id_json->valueint);
-        *stb_arr_add(opts) = "assigned_to_id";
-        *stb_arr_add(opts) = strdup(buf);
+    http_get_json_many(reqs, stb_arr_len(reqs), redmine_auth_headers, REDMINE_TIMEOUT, REDMINE_MAX_PARALLEL);
+
+    cJSON** owned = NULL;
+    for (int k = 0; k < stb_arr_len(reqs); k++) {
+        int i = req_issue[k];
+        cJSON* detail_json = reqs[k].json;
+        free((char*)reqs[k].url);
+        cJSON* detail_issue = cJSON_Select(detail_json, ".issue:o");
+        if (!detail_issue) {
+            cJSON_Delete(detail_json);
+            continue;
+        }
+
+        cJSON* issue_journals = cJSON_Select(detail_issue, ".journals:a");
+        issue_journals = issue_journals ? cJSON_DetachItemViaPointer(detail_issue, issue_journals)
+                                        : cJSON_CreateArray();
+        if (!issues[i]) {
+            issues[i] = detail_issue;
+            *stb_arr_add(owned) = detail_json;
+        } else {
+            cJSON_Delete(detail_json);
+        }
+
+        cJSON* updated_on = cJSON_Select(issues[i], ".updated_on:s");
+        if (updated_on)
+            redmine_journals_store(ids[i], updated_on->valuestring, issue_journals);
+        else
+            *stb_arr_add(owned) = issue_journals;
+        journals[i] = issue_journals;
     }
+    stb_arr_free(reqs);
+    stb_arr_free(req_issue);
 
-    cJSON* tracker_id_json = cJSON_Select(params, ".tracker_id:n");
-    if (tracker_id_json) {
-        snprintf(buf, sizeof(buf), "%d", tracker_id_json->valueint);
-        *stb_arr_add(opts) = "tracker_id";
-        *stb_arr_add(opts) = strdup(buf);
+    sds result = sdsempty();
+    for (int i = 0; i < n; i++) {
+        if (i > 0)
+            result = sdscat(result, result[sdslen(result) - 1] == '\n' ? "\n" : "\n\n");
+        if (issues[i])
+            result = format_issue(result, issues[i], ids[i], journals[i]);
+        else
+            result = sdscatprintf(result, "Issue #%d\nFailed to fetch issue from Redmine\n", ids[i]);
     }
 
-    cJSON* fixed_version_id_json = cJSON_Select(params, ".fixed_version_id:n");
-    if (fixed_version_id_json) {
-        snprintf(buf, sizeof(buf), "%d", fixed_version_id_json->valueint);
-        *stb_arr_add(opts) = "fixed_version_id";
-        *stb_arr_add(opts) = strdup(buf);
+    for (int k = 0; k < nlists; k++) {
+        cJSON_Delete(lists[k].json);
+        free((char*)lists[k].url);
     }
+    for (int k = 0; k < stb_arr_len(owned); k++)
+        cJSON_Delete(owned[k]);
+    stb_arr_free(owned);
+    free(lists);
+    free(issues);
+    free(journals);
+    stb_arr_free(ids);
+    meta_index_destroy(positions);
+
+    mcp_tool_call_result_add_text(r, result);
+    sdsfree(result);
+    return r;
+}
 
-    snprintf(buf, sizeof(buf), "%d", limit);
-    *stb_arr_add(opts) = "limit";
-    *stb_arr_add(opts) = strdup(buf);
+static McpInputSchema tool_get_issues_schema[] = {
+    { .name = "issue_ids",
+      .description = "Issue IDs to fetch, at most 500",
+      .type = MCP_INPUT_SCHEMA_TYPE_ARRAY,
+      .type_arr = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+    },
+    mcp_input_schema_null
+};
 
-    snprintf(buf, sizeof(buf), "%d", offset);
-    *stb_arr_add(opts) = "offset";
-    *stb_arr_add(opts) = strdup(buf);
+static McpTool tool_get_issues = {
+    .name = "get_issues",
+    .description = "Get detailed information about several issues at once",
+    .handler = get_issues_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_get_issues_schema,
+    },
+};
 
-    *stb_arr_add(opts) = "sort";
-    *stb_arr_add(opts) = strdup("updated_on:desc");
+static void format_issue_summary(cJSON* issue, void* userp)
+{
+    sds* result = userp;
+    cJSON* id = cJSON_Select(issue, ".id:n");
+    cJSON* subject = cJSON_Select(issue, ".subject:s");
+    cJSON* status = cJSON_Select(issue, ".status.name:s");
+    cJSON* priority = cJSON_Select(issue, ".priority.name:s");
+    cJSON* assigned_to = cJSON_Select(issue, ".assigned_to.name:s");
+    cJSON* project = cJSON_Select(issue, ".project.name:s");
+    cJSON* updated_on = cJSON_Select(issue, ".updated_on:s");
 
-    cJSON* json = redmine_get_with_opts("issues.json", opts, stb_arr_len(opts) / 2);
+    *result = sdscatprintf(*result, "#%d: %s\n", id ? id->valueint : 0, subject ? subject->valuestring : "N/A");
+    if (project)
+        *result = sdscatprintf(*result, "  Project: %s\n", project->valuestring);
+    if (status)
+        *result = sdscatprintf(*result, "  Status: %s\n", status->valuestring);
+    if (priority)
+        *result = sdscatprintf(*result, "  Priority: %s\n", priority->valuestring);
+    if (assigned_to)
+        *result = sdscatprintf(*result, "  Assigned to: %s\n", assigned_to->valuestring);
+    if (updated_on)
+        *result = sdscatprintf(*result, "  Updated: %s\n", updated_on->valuestring);
+    *result = sdscat(*result, "\n");
+}
 
-    for (int i = 0; i < stb_arr_len(opts); i += 2) {
-        free(opts[i + 1]);
-    }
-    stb_arr_free(opts);
+/* Arguments of list_issues, decoded by the dispatcher. Redmine ids start
+ * at 1, so 0 means the filter was not given. */
+typedef struct ListIssuesArgs {
+    int project_id;
+    const char* status_id;
+    int assigned_to_id;
+    int tracker_id;
+    int fixed_version_id;
+    int limit;
+    int offset;
+} ListIssuesArgs;
+
+static void list_issues_add_id(char*** opts, char (*bufs)[16], int* nbufs,
+                               const char* name, int id)
+{
+    if (id == 0)
+        return;
+    snprintf(bufs[*nbufs], sizeof(bufs[*nbufs]), "%d", id);
+    *stb_arr_add(*opts) = (char*)name;
+    *stb_arr_add(*opts) = bufs[(*nbufs)++];
+}
 
-    if (!json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to fetch issues from Redmine");
-        return r;
-    }
+static McpToolCallResult* list_issues_handler(const void* p)
+{
+    const ListIssuesArgs* args = p;
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    if (!r)
+        return NULL;
 
-    sds result = sdsempty();
+    int limit = args->limit < 1 ? 25 : args->limit;
+    int offset = args->offset < 0 ? 0 : args->offset;
 
-    cJSON* total_count = cJSON_Select(json, ".total_count:n");
-    if (total_count)
-        result = sdscatprintf(result, "Total: %d\n", total_count->valueint);
+    char** opts = NULL;
+    char bufs[4][16];
+    int nbufs = 0;
 
-    cJSON* off = cJSON_Select(json, ".offset:n");
-    if (off)
-        result = sdscatprintf(result, "Offset: %d\n", off->valueint);
+    list_issues_add_id(&opts, bufs, &nbufs, "project_id", args->project_id);
+    if (args->status_id) {
+        *stb_arr_add(opts) = "status_id";
+        *stb_arr_add(opts) = (char*)args->status_id;
+    }
+    list_issues_add_id(&opts, bufs, &nbufs, "assigned_to_id", args->assigned_to_id);
+    list_issues_add_id(&opts, bufs, &nbufs, "tracker_id", args->tracker_id);
+    list_issues_add_id(&opts, bufs, &nbufs, "fixed_version_id", args->fixed_version_id);
 
-    result = sdscat(result, "\n");
+    *stb_arr_add(opts) = "sort";
+    *stb_arr_add(opts) = "updated_on:desc";
 
-    cJSON* issues = cJSON_Select(json, ".issues:a");
-    if (!issues) {
-        cJSON_Delete(json);
-        sdsfree(result);
+    sds path = redmine_path_with_opts("issues.json", opts, stb_arr_len(opts) / 2);
+    stb_arr_free(opts);
+
+    RedminePage page;
+    sds items = sdsempty();
+    bool ok = redmine_get_paged(path, "issues", limit, offset, &page, format_issue_summary, &items);
+    sdsfree(path);
+
+    if (!ok) {
+        sdsfree(items);
         mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "No issues found");
+        mcp_tool_call_result_add_text(r, "Failed to fetch issues from Redmine");
         return r;
     }
 
-    cJSON* issue = NULL;
-    cJSON_ArrayForEach(issue, issues) {
-        cJSON* id = cJSON_Select(issue, ".id:n");
-        cJSON* subject = cJSON_Select(issue, ".subject:s");
-        cJSON* status = cJSON_Select(issue, ".status.name:s");
-        cJSON* priority = cJSON_Select(issue, ".priority.name:s");
-        cJSON* assigned_to = cJSON_Select(issue, ".assigned_to.name:s");
-        cJSON* project = cJSON_Select(issue, ".project.name:s");
-        cJSON* updated_on = cJSON_Select(issue, ".updated_on:s");
-
-        result = sdscatprintf(result, "#%d: %s\n", id ? id->valueint : 0, subject ? subject->valuestring : "N/A");
-        if (project)
-            result = sdscatprintf(result, "  Project: %s\n", project->valuestring);
-        if (status)
-            result = sdscatprintf(result, "  Status: %s\n", status->valuestring);
-        if (priority)
-            result = sdscatprintf(result, "  Priority: %s\n", priority->valuestring);
-        if (assigned_to)
-            result = sdscatprintf(result, "  Assigned to: %s\n", assigned_to->valuestring);
-        if (updated_on)
-            result = sdscatprintf(result, "  Updated: %s\n", updated_on->valuestring);
-        result = sdscat(result, "\n");
-    }
-
-    cJSON_Delete(json);
-
+    sds result = format_page_header(&page, items);
     mcp_tool_call_result_add_text(r, result);
     sdsfree(result);
     return r;
@@ -1232,30 +3852,37 @@ static McpInputSchema tool_list_issues_schema[] = {
     { .name = "project_id",
       .description = "Filter by project ID (optional)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, project_id),
     },
     { .name = "status_id",
       .description = "Filter by status ID (optional, use * for all statuses or use list_issue_statuses to get valid IDs)",
       .type = MCP_INPUT_SCHEMA_TYPE_STRING,
+      .bind = MCP_ARG_STRING, .offset = offsetof(ListIssuesArgs, status_id),
     },
     { .name = "assigned_to_id",
       .description = "Filter by assigned user ID (optional)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, assigned_to_id),
     },
     { .name = "tracker_id",
       .description = "Filter by tracker ID (optional, use list_trackers to get valid IDs)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, tracker_id),
     },
     { .name = "fixed_version_id",
       .description = "Filter by fixed version ID (optional, use list_versions to get valid IDs)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, fixed_version_id),
     },
     { .name = "limit",
-      .description = "Maximum number of results to return (optional, default: 25)",
+      .description = "Maximum number of results to return (optional, default: 25, more than 100 are fetched in pages)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, limit), .def_number = 25,
     },
     { .name = "offset",
       .description = "Skip this number of results for pagination (optional, default: 0)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+      .bind = MCP_ARG_INT, .offset = offsetof(ListIssuesArgs, offset),
     },
     mcp_input_schema_null
 };
@@ -1263,7 +3890,8 @@ static McpInputSchema tool_list_issues_schema[] = {
 static McpTool tool_list_issues = {
     .name = "list_issues",
     .description = "List issues from Redmine with optional filters",
-    .handler = list_issues_handler,
+    .typed_handler = list_issues_handler,
+    .args_size = sizeof(ListIssuesArgs),
     .input_schema = {
         .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
         .properties = tool_list_issues_schema,
@@ -1303,21 +3931,8 @@ static McpToolCallResult* add_issue_note_handler(cJSON* params)
     char path[128];
     snprintf(path, sizeof(path), "issues/%d.json", issue_id);
 
-    cJSON* json = redmine_post(path, data);
+    redmine_write(r, REDMINE_WRITE_ISSUE_NOTE, path, data, issue_id);
     free(data);
-
-    if (!json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to add note to issue");
-        return r;
-    }
-
-    sds result = sdsempty();
-    result = sdscatprintf(result, "Note added to issue #%d\n", issue_id);
-    cJSON_Delete(json);
-
-    mcp_tool_call_result_add_text(r, result);
-    sdsfree(result);
     return r;
 }
 
@@ -1411,27 +4026,8 @@ static McpToolCallResult* create_issue_handler(cJSON* params)
     char* data = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
 
-    cJSON* json = redmine_post("issues.json", data);
+    redmine_write(r, REDMINE_WRITE_ISSUE, "issues.json", data, 0);
     free(data);
-
-    if (!json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to create issue");
-        return r;
-    }
-
-    sds result = sdsempty();
-    cJSON* issue = cJSON_Select(json, ".issue");
-    if (issue) {
-        cJSON* id = cJSON_Select(issue, ".id:n");
-        if (id)
-            result = sdscatprintf(result, "Issue #%d created successfully\n", id->valueint);
-    }
-
-    cJSON_Delete(json);
-
-    mcp_tool_call_result_add_text(r, result);
-    sdsfree(result);
     return r;
 }
 
@@ -1662,16 +4258,42 @@ static McpToolCallResult* download_attachment_handler(cJSON* params)
 
     /*
      * For SVG files, return as text since SVG is XML text format.
-     * For other formats, return as base64-encoded image/blob.
+     * For other formats, return as base64-encoded image/blob: small ones are
+     * encoded on the fly while downloading, large ones are spooled to a
+     * temporary file and encoded while the response is written. Anything
+     * over the inline limit is returned as a link.
      */
     int is_svg = mime && strcmp(mime, "image/svg+xml") == 0;
 
-    BinaryBuffer* buf = redmine_download_binary(content_url->valuestring);
-    if (!buf || !buf->data) {
+    cJSON* filesize = cJSON_Select(json, ".attachment.filesize:n");
+    size_t size = filesize && filesize->valuedouble > 0 ? (size_t)filesize->valuedouble : 0;
+    size_t max_inline = mcp_get_max_inline_size();
+    int is_link = !is_svg && max_inline && size > max_inline;
+    int is_spooled = !is_svg && !is_link && size > REDMINE_SPOOL_SIZE;
+
+    BinaryBuffer buf = { NULL, 0 };
+    McpBase64 b64;
+    mcp_base64_init(&b64);
+    int fd = -1;
+
+    bool ok = true;
+    if (is_svg) {
+        ok = redmine_download(content_url->valuestring, write_binary_callback, &buf);
+        ok = ok && buf.data;
+    } else if (is_spooled) {
+        fd = redmine_spool_open();
+        ok = fd >= 0 && redmine_download(content_url->valuestring, write_fd_callback, &fd);
+        ok = ok && lseek(fd, 0, SEEK_SET) == 0;
+    } else if (!is_link) {
+        mcp_base64_reserve(&b64, size);
+        ok = redmine_download(content_url->valuestring, write_base64_callback, &b64);
+    }
+
+    if (!ok) {
         cJSON_Delete(json);
-        if (buf) {
-            free(buf);
-        }
+        free(buf.data);
+        mcp_base64_free(&b64);
+        if (fd >= 0) close(fd);
         mcp_tool_call_result_set_error(r);
         mcp_tool_call_result_add_text(r, "Failed to download attachment");
         return r;
@@ -1687,32 +4309,29 @@ static McpToolCallResult* download_attachment_handler(cJSON* params)
 
     if (is_svg) {
         /* SVG: return as text */
-        char* text = malloc(buf->size + 1);
+        char* text = malloc(buf.size + 1);
         if (text) {
-            memcpy(text, buf->data, buf->size);
-            text[buf->size] = '\0';
+            memcpy(text, buf.data, buf.size);
+            text[buf.size] = '\0';
             mcp_tool_call_result_add_text(r, text);
             free(text);
         }
-        free(buf->data);
-        free(buf);
+        free(buf.data);
+    } else if (is_link) {
+        mcp_tool_call_result_add_resource_link(r, content_url->valuestring,
+            filename ? filename->valuestring : NULL, mime, size);
+    } else if (is_spooled) {
+        if (!mcp_tool_call_result_add_image_fd(r, fd, mime, content_url->valuestring))
+            close(fd);
     } else {
-        /* Other formats: return as base64-encoded image/blob */
-        size_t encoded_len;
-        char* encoded = base64_encode((unsigned char*)buf->data, buf->size,
-                                       &encoded_len);
-        free(buf->data);
-        free(buf);
-
-        if (!encoded) {
+        char* encoded = mcp_base64_finish(&b64, NULL);
+        if (!encoded || !mcp_tool_call_result_add_image_owned(r, encoded, mime)) {
+            free(encoded);
             cJSON_Delete(json);
             mcp_tool_call_result_set_error(r);
             mcp_tool_call_result_add_text(r, "Failed to encode attachment");
             return r;
         }
-
-        mcp_tool_call_result_add_image(r, encoded, mime);
-        free(encoded);
     }
 
     cJSON_Delete(json);
@@ -1735,6 +4354,8 @@ static McpTool tool_download_attachment = {
         .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
         .properties = tool_download_attachment_schema,
     },
+    /* Big attachments take a while */
+    .timeout_ms = 10 * 60 * 1000,
 };
 
 static McpToolCallResult* list_wiki_pages_handler(cJSON* params)
@@ -1816,6 +4437,37 @@ static McpTool tool_list_wiki_pages = {
     },
 };
 
+static void format_time_entry(cJSON* entry, void* userp)
+{
+    sds* result = userp;
+    cJSON* id = cJSON_Select(entry, ".id:n");
+    cJSON* project = cJSON_Select(entry, ".project.name:s");
+    cJSON* issue = cJSON_Select(entry, ".issue.id:n");
+    cJSON* user = cJSON_Select(entry, ".user.name:s");
+    cJSON* activity = cJSON_Select(entry, ".activity.name:s");
+    cJSON* hours = cJSON_Select(entry, ".hours:n");
+    cJSON* comments = cJSON_Select(entry, ".comments:s");
+    cJSON* spent_on = cJSON_Select(entry, ".spent_on:s");
+
+    if (id)
+        *result = sdscatprintf(*result, "Entry #%d\n", id->valueint);
+    if (project)
+        *result = sdscatprintf(*result, "  Project: %s\n", project->valuestring);
+    if (issue)
+        *result = sdscatprintf(*result, "  Issue: #%d\n", issue->valueint);
+    if (user)
+        *result = sdscatprintf(*result, "  User: %s\n", user->valuestring);
+    if (activity)
+        *result = sdscatprintf(*result, "  Activity: %s\n", activity->valuestring);
+    if (hours)
+        *result = sdscatprintf(*result, "  Hours: %.2f\n", hours->valuedouble);
+    if (comments)
+        *result = sdscatprintf(*result, "  Comments: %s\n", comments->valuestring);
+    if (spent_on)
+        *result = sdscatprintf(*result, "  Date: %s\n", spent_on->valuestring);
+    *result = sdscat(*result, "\n");
+}
+
 static McpToolCallResult* list_time_entries_handler(cJSON* params)
 {
     McpToolCallResult* r = mcp_tool_call_result_create();
@@ -1858,69 +4510,18 @@ static McpToolCallResult* list_time_entries_handler(cJSON* params)
     }
 
     char path[1024];
-    snprintf(path, sizeof(path), "time_entries.json?%slimit=%d&offset=%d&sort=spent_on:desc",
-        query, limit, offset);
+    snprintf(path, sizeof(path), "time_entries.json?%ssort=spent_on:desc", query);
 
-    cJSON* json = redmine_get(path);
-    if (!json) {
+    RedminePage page;
+    sds items = sdsempty();
+    if (!redmine_get_paged(path, "time_entries", limit, offset, &page, format_time_entry, &items)) {
+        sdsfree(items);
         mcp_tool_call_result_set_error(r);
         mcp_tool_call_result_add_text(r, "Failed to fetch time entries from Redmine");
         return r;
     }
 
-    sds result = sdsempty();
-
-    cJSON* total_count = cJSON_Select(json, ".total_count:n");
-    if (total_count)
-        result = sdscatprintf(result, "Total: %d\n", total_count->valueint);
-
-    cJSON* off = cJSON_Select(json, ".offset:n");
-    if (off)
-        result = sdscatprintf(result, "Offset: %d\n", off->valueint);
-
-    result = sdscat(result, "\n");
-
-    cJSON* time_entries = cJSON_Select(json, ".time_entries:a");
-    if (!time_entries) {
-        cJSON_Delete(json);
-        sdsfree(result);
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "No time entries found");
-        return r;
-    }
-
-    cJSON* entry = NULL;
-    cJSON_ArrayForEach(entry, time_entries) {
-        cJSON* id = cJSON_Select(entry, ".id:n");
-        cJSON* project = cJSON_Select(entry, ".project.name:s");
-        cJSON* issue = cJSON_Select(entry, ".issue.id:n");
-        cJSON* user = cJSON_Select(entry, ".user.name:s");
-        cJSON* activity = cJSON_Select(entry, ".activity.name:s");
-        cJSON* hours = cJSON_Select(entry, ".hours:n");
-        cJSON* comments = cJSON_Select(entry, ".comments:s");
-        cJSON* spent_on = cJSON_Select(entry, ".spent_on:s");
-
-        if (id)
-            result = sdscatprintf(result, "Entry #%d\n", id->valueint);
-        if (project)
-            result = sdscatprintf(result, "  Project: %s\n", project->valuestring);
-        if (issue)
-            result = sdscatprintf(result, "  Issue: #%d\n", issue->valueint);
-        if (user)
-            result = sdscatprintf(result, "  User: %s\n", user->valuestring);
-        if (activity)
-            result = sdscatprintf(result, "  Activity: %s\n", activity->valuestring);
-        if (hours)
-            result = sdscatprintf(result, "  Hours: %.2f\n", hours->valuedouble);
-        if (comments)
-            result = sdscatprintf(result, "  Comments: %s\n", comments->valuestring);
-        if (spent_on)
-            result = sdscatprintf(result, "  Date: %s\n", spent_on->valuestring);
-        result = sdscat(result, "\n");
-    }
-
-    cJSON_Delete(json);
-
+    sds result = format_page_header(&page, items);
     mcp_tool_call_result_add_text(r, result);
     sdsfree(result);
     return r;
@@ -1940,7 +4541,7 @@ static McpInputSchema tool_list_time_entries_schema[] = {
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
     },
     { .name = "limit",
-      .description = "Maximum number of results to return (optional, default: 25)",
+      .description = "Maximum number of results to return (optional, default: 25, more than 100 are fetched in pages)",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
     },
     { .name = "offset",
@@ -2008,36 +4609,8 @@ static McpToolCallResult* create_time_entry_handler(cJSON* params)
     char* data_str = cJSON_PrintUnformatted(data);
     cJSON_Delete(data);
 
-    cJSON* json = redmine_post("time_entries.json", data_str);
+    redmine_write(r, REDMINE_WRITE_TIME_ENTRY, "time_entries.json", data_str, 0);
     free(data_str);
-    if (!json) {
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "Failed to create time entry");
-        return r;
-    }
-
-    sds result = sdsempty();
-
-    cJSON* errors = cJSON_Select(json, ".errors:a");
-    if (errors) {
-        cJSON* error = NULL;
-        cJSON_ArrayForEach(error, errors) {
-            result = sdscatfmt(result, "%s\n", error->valuestring ? error->valuestring : "");
-        }
-        mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, result);
-        sdsfree(result);
-        return r;
-    }
-
-    cJSON* time_entry_id = cJSON_Select(json, ".time_entry.id:n");
-    if (time_entry_id)
-        result = sdscatprintf(result, "Time entry #%d created successfully\n", time_entry_id->valueint);
-
-    cJSON_Delete(json);
-
-    mcp_tool_call_result_add_text(r, result);
-    sdsfree(result);
     return r;
 }
 
@@ -2075,6 +4648,90 @@ static McpTool tool_create_time_entry = {
     },
 };
 
+static sds format_write(sds result, const WriteEntry* e)
+{
+    char created[32];
+    strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&e->created_at));
+    result = sdscatprintf(result, "Write #%d\n", e->ticket);
+    result = sdscatprintf(result, "Tool: %s\n", redmine_write_kinds[e->kind].name);
+    result = sdscatprintf(result, "Status: %s\n", write_state_names[e->state]);
+    result = sdscatprintf(result, "Queued: %s\n", created);
+    result = sdscatprintf(result, "Attempts: %d\n", e->attempts);
+    if (e->result && *e->result) {
+        const char* label = write_entry_finished(e) ? "Result" : "Last error";
+        result = sdscatprintf(result, "%s: %s", label, e->result);
+        if (e->result[strlen(e->result) - 1] != '\n')
+            result = sdscat(result, "\n");
+    }
+    return result;
+}
+
+static McpToolCallResult* get_write_status_handler(cJSON* params)
+{
+    McpToolCallResult* r = mcp_tool_call_result_create();
+    if (!r)
+        return NULL;
+
+    if (redmine_write_journal_fd < 0) {
+        mcp_tool_call_result_set_error(r);
+        mcp_tool_call_result_add_text(r, "Write queue is disabled, set REDMINE_WRITE_QUEUE to enable it");
+        return r;
+    }
+
+    cJSON* ticket_json = cJSON_Select(params, ".ticket:n");
+    sds result = sdsempty();
+
+    pthread_mutex_lock(&redmine_write_lock);
+    if (ticket_json) {
+        WriteEntry* e = redmine_write_find(ticket_json->valueint);
+        if (e) {
+            result = format_write(result, e);
+        } else {
+            mcp_tool_call_result_set_error(r);
+            result = sdscatprintf(result, "Write #%d not found\n", ticket_json->valueint);
+        }
+    } else {
+        int counts[WRITE_STATES_LEN] = { 0 };
+        for (int i = 0; i < stb_arr_len(redmine_writes); i++)
+            counts[redmine_writes[i]->state]++;
+        for (size_t i = 0; i < WRITE_STATES_LEN; i++)
+            result = sdscatprintf(result, "%s%s: %d", i ? ", " : "", write_state_names[i], counts[i]);
+        result = sdscat(result, "\n");
+
+        /* Every write not done is listed */
+        for (int i = 0; i < stb_arr_len(redmine_writes); i++) {
+            WriteEntry* e = redmine_writes[i];
+            if (e->state == WRITE_DONE)
+                continue;
+            result = sdscat(result, "\n");
+            result = format_write(result, e);
+        }
+    }
+    pthread_mutex_unlock(&redmine_write_lock);
+
+    mcp_tool_call_result_add_text(r, result);
+    sdsfree(result);
+    return r;
+}
+
+static McpInputSchema tool_get_write_status_schema[] = {
+    { .name = "ticket",
+      .description = "Write number returned when the write was queued (optional, default: all writes not done)",
+      .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
+    },
+    mcp_input_schema_null
+};
+
+static McpTool tool_get_write_status = {
+    .name = "get_write_status",
+    .description = "Get the outcome of queued create_issue, add_issue_note and create_time_entry calls",
+    .handler = get_write_status_handler,
+    .input_schema = {
+        .type = MCP_INPUT_SCHEMA_TYPE_OBJECT,
+        .properties = tool_get_write_status_schema,
+    },
+};
+
 static McpToolCallResult* list_versions_handler(cJSON* params)
 {
     (void)params;
@@ -2090,17 +4747,11 @@ static McpToolCallResult* list_versions_handler(cJSON* params)
         return r;
     }
 
-    Project* redmine_projects = redmine_projects_get();
     sds result = sdsempty();
     for (int i = 0; i < stb_arr_len(redmine_versions); i++) {
         Version* v = &redmine_versions[i];
-        const char* project_name = "Unknown";
-        for (int j = 0; j < stb_arr_len(redmine_projects); j++) {
-            if (redmine_projects[j].id == v->project_id) {
-                project_name = redmine_projects[j].name;
-                break;
-            }
-        }
+        Project* project = redmine_project_by_id(v->project_id);
+        const char* project_name = project ? project->name : "Unknown";
         result = sdscatprintf(result, "ID: %d - Name: %s (Project: %s)\n", 
             v->id, v->name, project_name);
     }
@@ -2250,14 +4901,25 @@ static McpToolCallResult* get_project_handler(cJSON* params)
     if (!r)
         return NULL;
 
+    int project_id;
     cJSON* project_id_json = cJSON_Select(params, ".project_id:n");
-    if (!project_id_json) {
+    cJSON* identifier_json = cJSON_Select(params, ".project_identifier:s");
+    if (project_id_json) {
+        project_id = project_id_json->valueint;
+    } else if (identifier_json) {
+        Project* p = redmine_project_by_identifier(identifier_json->valuestring);
+        if (!p) {
+            mcp_tool_call_result_set_error(r);
+            mcp_tool_call_result_add_textf(r, "Unknown project identifier: %s", identifier_json->valuestring);
+            return r;
+        }
+        project_id = p->id;
+    } else {
         mcp_tool_call_result_set_error(r);
-        mcp_tool_call_result_add_text(r, "project_id parameter is required");
+        mcp_tool_call_result_add_text(r, "project_id or project_identifier parameter is required");
         return r;
     }
 
-    int project_id = project_id_json->valueint;
     char path[128];
     snprintf(path, sizeof(path), "projects/%d.json?include=trackers,issue_categories", project_id);
 
@@ -2336,6 +4998,10 @@ static McpInputSchema tool_get_project_schema[] = {
       .description = "Project ID to fetch details for",
       .type = MCP_INPUT_SCHEMA_TYPE_NUMBER,
     },
+    { .name = "project_identifier",
+      .description = "Project identifier (e.g., 'my-project'), used when project_id is not given",
+      .type = MCP_INPUT_SCHEMA_TYPE_STRING,
+    },
     mcp_input_schema_null
 };
 
@@ -2468,6 +5134,7 @@ int main(int argc, const char* argv[])
     redmine_init();
 
     mcp_set_name("redmine-mcp");
+    mcp_set_default_timeout(REDMINE_TOOL_TIMEOUT);
     mcp_set_version("1.0.0");
     mcp_add_tool(&tool_list_projects);
     mcp_add_tool(&tool_list_versions);
@@ -2476,6 +5143,7 @@ int main(int argc, const char* argv[])
     mcp_add_tool(&tool_list_activities);
     mcp_add_tool(&tool_search_wiki);
     mcp_add_tool(&tool_get_issue);
+    mcp_add_tool(&tool_get_issues);
     mcp_add_tool(&tool_list_issues);
     mcp_add_tool(&tool_add_issue_note);
     mcp_add_tool(&tool_create_issue);
@@ -2485,6 +5153,7 @@ int main(int argc, const char* argv[])
     mcp_add_tool(&tool_list_time_entries);
     mcp_add_tool(&tool_list_time_entry_activities);
     mcp_add_tool(&tool_create_time_entry);
+    mcp_add_tool(&tool_get_write_status);
     mcp_add_tool(&tool_get_project);
     mcp_add_tool(&tool_get_user);
     mcp_add_tool(&tool_get_my_user_id);
@@ -2492,7 +5161,7 @@ int main(int argc, const char* argv[])
     fprintf(stderr, "Redmine MCP Server running...\n");
     mcp_main(argc, argv);
 
-    curl_global_cleanup();
     redmine_cleanup();
+    curl_global_cleanup();
     return 0;
 }
@@ -7,32 +7,201 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MCP_BASE64_X86 1
+#include <immintrin.h>
+#endif
 
 #define MCP_MAX_TOOLS 128
 #define MCP_MAX_PROMPTS 128
 #define MCP_BUFFER_SIZE 8192
+/* stdio buffer of mcp_out, the size of the chunks queued for output */
+#define MCP_OUT_BUFFER_SIZE 65536
+
+#define JSONRPC_PARSE_ERROR -32700
+#define JSONRPC_INVALID_REQUEST -32600
+#define JSONRPC_METHOD_NOT_FOUND -32601
+#define JSONRPC_INVALID_PARAMS -32602
+
+/* Plain progress notifications are sent at most this often */
+#define MCP_PROGRESS_INTERVAL_MS 100
 
 static const char* mcp_server_name = NULL;
 static const char* mcp_server_version = NULL;
 static McpTool mcp_server_tools[MCP_MAX_TOOLS];
 
+/* Protocol revisions spoken, newest first */
+static const char* const mcp_protocol_versions[] = { "2025-06-18", "2025-03-26", "2024-11-05", NULL };
+/* Set by initialize when the client speaks 2025-06-18 or later, which
+ * brought structuredContent, outputSchema and resource_link content */
+static atomic_bool mcp_protocol_structured = true;
+
+/* A tool's input schema compiled for checking arguments: one check per
+ * top level property, in the order of input_schema.properties, then one
+ * per required name not among them */
+typedef struct McpArgCheck {
+    const char* name;
+    unsigned int types;         /* McpInputSchemaTypeEnum bits, 0 for any */
+    unsigned int item_types;    /* of array items, 0 for any */
+    bool required;
+    const McpInputSchema* bind; /* where the value goes, if bound */
+} McpArgCheck;
+
+typedef struct McpArgProgram {
+    McpArgCheck* checks;
+    int n;
+} McpArgProgram;
+
+static McpArgProgram mcp_server_programs[MCP_MAX_TOOLS];
+static size_t mcp_max_inline = 0;
+static unsigned int mcp_default_timeout = 0;
+static void (*mcp_call_enter)(void) = NULL;
+static void (*mcp_call_leave)(void) = NULL;
+
+/* Responses are written by the main loop and by threads completing async
+ * calls, one whole message at a time. mcp_out feeds the output queue. */
+static FILE* mcp_out = NULL;
+static pthread_mutex_t mcp_out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Output queue, drained to stdout by the writer thread. Above the high
+ * watermark the reader stops taking requests and producers wait, until
+ * the client has read it down to the low one. */
+typedef struct McpOutChunk {
+    char* data;
+    size_t len;
+    struct McpOutChunk* next;
+} McpOutChunk;
+
+static McpOutChunk* mcp_outq_head = NULL;
+static McpOutChunk* mcp_outq_tail = NULL;
+static size_t mcp_outq_bytes = 0;
+static size_t mcp_outq_high = 4 << 20;
+static size_t mcp_outq_low = 1 << 20;
+static bool mcp_outq_full = false;      /* went over high, not yet under low */
+static bool mcp_outq_closed = false;
+static McpOutputStats mcp_outq_stats;
+static pthread_mutex_t mcp_outq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mcp_outq_cond = PTHREAD_COND_INITIALIZER;
+
+/* Sync handlers of a batch run on up to this many threads */
+static int mcp_batch_parallel = 1;
+
+/* A JSON-RPC batch being answered. Each element's response is kept in its
+ * slot, NULL for notifications and dropped calls, and the whole array is
+ * written at once when the last one is in. */
+typedef struct McpBatch {
+    cJSON* requests;
+    struct { char* data; size_t len; }* slots;
+    int pending;                /* slots not answered, under mcp_out_lock */
+    atomic_int next;            /* next element to dispatch */
+} McpBatch;
+
+struct McpCallCtx {
+    cJSON* id;
+    cJSON* params;
+    atomic_bool cancelled;
+    atomic_bool responded;      /* set by whoever writes the response */
+    unsigned int timeout_ms;
+    long long deadline;         /* mcp_now_ms(), 0 for none */
+    cJSON* progress_token;      /* params._meta.progressToken, if asked for */
+    bool structured_only;       /* params._meta.structuredOnly, see mcp_call_wants_text() */
+    double progress;            /* last reported, under mcp_out_lock */
+    long long progress_at;
+    McpBatch* batch;            /* answered into batch->slots[slot] if set */
+    int slot;
+    cJSON** args;               /* arguments by schema property, see mcp_call_arg() */
+    int nargs;
+    void* bound;                /* McpTool.args_size bytes, see mcp_call_args() */
+    struct McpCallCtx* next;
+};
+
+/* Tool calls not completed yet. The watchdog thread answers those past
+ * their deadline. */
+static McpCallCtx* mcp_calls = NULL;
+static bool mcp_watchdog_stop = false;
+static pthread_mutex_t mcp_calls_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mcp_calls_cond = PTHREAD_COND_INITIALIZER;
+
+/* The call whose synchronous handler runs on this thread */
+static __thread McpCallCtx* mcp_current_call = NULL;
+
+/* Raw JSON of a value within a message, strings with their quotes */
+typedef struct McpSpan {
+    const char* p;
+    size_t len;
+} McpSpan;
+
+/* What routing a request needs, found without parsing it */
+typedef struct McpEnvelope {
+    McpSpan jsonrpc;
+    McpSpan id;
+    McpSpan method;
+    McpSpan params;
+    McpSpan name;               /* params.name */
+} McpEnvelope;
+
+/* Requests read by the reader thread, waiting for the dispatcher. Single
+ * requests are kept as scanned and only parsed once dispatched, batches
+ * are parsed right away. */
+typedef struct McpRequest {
+    cJSON* json;
+    char* message;
+    McpEnvelope env;
+    cJSON* id;                  /* parsed from env.id */
+    int error;                  /* answer with this JSON-RPC error instead */
+    struct McpRequest* next;
+} McpRequest;
+
+static McpRequest* mcp_requests_head = NULL;
+static McpRequest* mcp_requests_tail = NULL;
+static bool mcp_requests_eof = false;
+static pthread_mutex_t mcp_requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mcp_requests_cond = PTHREAD_COND_INITIALIZER;
+
+static void mcp_request_free(McpRequest* r)
+{
+    cJSON_Delete(r->json);
+    cJSON_Delete(r->id);
+    free(r->message);
+    free(r);
+}
+
+static cJSON* mcp_request_id(McpRequest* r)
+{
+    return r->json ? cJSON_GetObjectItem(r->json, "id") : r->id;
+}
+
 static cJSON* jsonrpc_initialize(cJSON*);
 static cJSON* jsonrpc_tools_list(cJSON*);
-static cJSON* jsonrpc_tools_call(cJSON*);
+static bool jsonrpc_tools_call(cJSON*, McpBatch*, int);
+static void mcp_reply_error(cJSON* id, int code, const char* message, McpBatch* batch, int slot);
 static cJSON* jsonrpc_notifications_initialized(cJSON*);
+static ssize_t mcp_fd_read(void* ctx, void* buf, size_t len);
 
 typedef struct JsonrpcMethod {
     const char* name;
     cJSON* (*handler)(cJSON*);
+    /* Tool calls are not built as cJSON, their result is streamed out. They
+     * get the whole request and answer it themselves, maybe later. Returns
+     * false if the request was dropped without being taken on. */
+    bool (*call)(cJSON* request, McpBatch* batch, int slot);
 } JsonrpcMethod;
 
 static JsonrpcMethod jsonrpc_methods[] = {
-    { "initialize", jsonrpc_initialize },
-    { "tools/list", jsonrpc_tools_list },
-    { "tools/call", jsonrpc_tools_call },
-    { "notifications/initialized", jsonrpc_notifications_initialized },
-    { NULL, NULL },
+    { "initialize", jsonrpc_initialize, NULL },
+    { "tools/list", jsonrpc_tools_list, NULL },
+    { "tools/call", NULL, jsonrpc_tools_call },
+    { "notifications/initialized", jsonrpc_notifications_initialized, NULL },
+    { NULL, NULL, NULL },
 };
 
 static char* read_jsonrpc_message(FILE* in)
@@ -67,6 +236,336 @@ static void write_jsonrpc_message(FILE* out, cJSON* json)
     free(s);
 }
 
+/* Same escaping rules as cJSON's printer */
+static void write_json_string(FILE* out, const char* s)
+{
+    fputc('"', out);
+    const char* run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 32 && c != '"' && c != '\\')
+            continue;
+
+        fwrite(run, 1, s - run, out);
+        run = s + 1;
+        switch (c) {
+            case '"':  fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\b': fputs("\\b", out); break;
+            case '\f': fputs("\\f", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default:   fprintf(out, "\\u%04x", c); break;
+        }
+    }
+    fwrite(run, 1, s - run, out);
+    fputc('"', out);
+}
+
+/* Numbers as cJSON prints them: integers plainly, others with the shortest
+ * of 15 or 17 digits that reads back the same */
+static void write_json_number(FILE* out, double d)
+{
+    if (isnan(d) || isinf(d)) {
+        fputs("null", out);
+    } else if (d >= INT_MIN && d <= INT_MAX && d == (double)(int)d) {
+        fprintf(out, "%d", (int)d);
+    } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%1.15g", d);
+        if (strtod(buf, NULL) != d)
+            snprintf(buf, sizeof(buf), "%1.17g", d);
+        fputs(buf, out);
+    }
+}
+
+/* Stream a cJSON tree without printing it into a buffer first */
+static void write_json_value(FILE* out, const cJSON* json)
+{
+    if (json == NULL) {
+        fputs("null", out);
+        return;
+    }
+
+    switch (json->type & 0xFF) {
+        case cJSON_False:  fputs("false", out); break;
+        case cJSON_True:   fputs("true", out); break;
+        case cJSON_NULL:   fputs("null", out); break;
+        case cJSON_Number: write_json_number(out, json->valuedouble); break;
+        case cJSON_String: write_json_string(out, json->valuestring ? json->valuestring : ""); break;
+        case cJSON_Raw:    fputs(json->valuestring ? json->valuestring : "null", out); break;
+        case cJSON_Array:
+            fputc('[', out);
+            for (const cJSON* c = json->child; c != NULL; c = c->next) {
+                if (c != json->child)
+                    fputc(',', out);
+                write_json_value(out, c);
+            }
+            fputc(']', out);
+            break;
+        case cJSON_Object:
+            fputc('{', out);
+            for (const cJSON* c = json->child; c != NULL; c = c->next) {
+                if (c != json->child)
+                    fputc(',', out);
+                write_json_string(out, c->string ? c->string : "");
+                fputc(':', out);
+                write_json_value(out, c);
+            }
+            fputc('}', out);
+            break;
+        default:
+            fputs("null", out);
+            break;
+    }
+}
+
+#define MCP_STREAM_CHUNK (3 * 16384)
+
+/* Pull the producer dry, base64 encoding each chunk straight into out */
+static void write_content_stream(FILE* out, McpContentItem* it)
+{
+    unsigned char* raw = malloc(MCP_STREAM_CHUNK);
+    char* encoded = malloc(MCP_STREAM_CHUNK / 3 * 4 + 1);
+    if (!raw || !encoded) {
+        free(raw);
+        free(encoded);
+        return;
+    }
+
+    bool eof = false;
+    while (!eof) {
+        /* Fill whole chunks so that only the last one needs padding */
+        size_t len = 0;
+        while (len < MCP_STREAM_CHUNK) {
+            ssize_t n = it->stream.read(it->stream.ctx, raw + len, MCP_STREAM_CHUNK - len);
+            if (n <= 0) {
+                if (n < 0)
+                    fprintf(stderr, "Content stream failed, output truncated\n");
+                eof = true;
+                break;
+            }
+            len += n;
+        }
+        fwrite(encoded, 1, mcp_base64_encode(encoded, raw, len), out);
+    }
+
+    free(raw);
+    free(encoded);
+}
+
+/* A file read from the result must still hold the size it was added with.
+ * Checked before the response starts, as a short read partway through can
+ * only truncate the image already on its way to the client. */
+static bool mcp_content_streams_ready(const McpToolCallResult* r)
+{
+    for (const McpContentItem* it = r->head; it != NULL; it = it->next) {
+        if (it->stream.read != mcp_fd_read || it->stream.size == 0)
+            continue;
+        int fd = (int)(intptr_t)it->stream.ctx;
+        struct stat st;
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        if (pos < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+            st.st_size - pos != (off_t)it->stream.size)
+            return false;
+    }
+    return true;
+}
+
+static void write_content_item(FILE* out, McpContentItem* it)
+{
+    if (it->type == MCP_CONTENT_TYPE_TEXT) {
+        fputs("{\"type\":\"text\",\"text\":", out);
+        write_json_string(out, it->text ? it->text : "");
+        fputc('}', out);
+    } else if (it->type == MCP_CONTENT_TYPE_IMAGE) {
+        /* Base64 never needs escaping, write it as is */
+        fputs("{\"type\":\"image\",\"data\":\"", out);
+        if (it->stream.read)
+            write_content_stream(out, it);
+        else if (it->data)
+            fputs(it->data, out);
+        fputs("\",\"mimeType\":", out);
+        write_json_string(out, it->mime_type ? it->mime_type : "");
+        fputc('}', out);
+    } else if (it->type == MCP_CONTENT_TYPE_RESOURCE_LINK && !atomic_load(&mcp_protocol_structured)) {
+        /* Older clients get the link as text */
+        const char* name = it->text ? it->text : "";
+        const char* uri = it->uri ? it->uri : "";
+        char* link = malloc(strlen(name) + strlen(uri) + 4);
+        if (link)
+            sprintf(link, "%s <%s>", name, uri);
+        fputs("{\"type\":\"text\",\"text\":", out);
+        write_json_string(out, link ? link : uri);
+        fputc('}', out);
+        free(link);
+    } else if (it->type == MCP_CONTENT_TYPE_RESOURCE_LINK) {
+        fputs("{\"type\":\"resource_link\",\"uri\":", out);
+        write_json_string(out, it->uri ? it->uri : "");
+        fputs(",\"name\":", out);
+        write_json_string(out, it->text ? it->text : "");
+        if (it->mime_type) {
+            fputs(",\"mimeType\":", out);
+            write_json_string(out, it->mime_type);
+        }
+        if (it->stream.size)
+            fprintf(out, ",\"size\":%zu", it->stream.size);
+        fputc('}', out);
+    } else {
+        fputs("{\"type\":\"unknown\"}", out);
+    }
+}
+
+static void write_jsonrpc_begin(FILE* out, cJSON* id)
+{
+    char* id_str = id ? cJSON_PrintUnformatted(id) : NULL;
+    fprintf(out, "{\"jsonrpc\":\"2.0\",\"id\":%s,\"result\":", id_str ? id_str : "null");
+    free(id_str);
+}
+
+static void write_jsonrpc_error(FILE* out, const char* id, size_t id_len,
+                                int code, const char* message)
+{
+    fprintf(out, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"error\":{\"code\":%d,\"message\":",
+            (int)id_len, id, code);
+    write_json_string(out, message);
+    fputs("}}\n", out);
+    fflush(out);
+}
+
+/* Tool call results are written piecewise so that large content goes out
+ * in chunks instead of being assembled in memory first. Structured content
+ * with no text beside it is also sent as JSON text, for clients that do
+ * not read structuredContent, unless the client asked for it alone; then
+ * text items are left out instead. Clients older than 2025-06-18 only get
+ * the text. */
+static void write_tool_call_result(FILE* out, cJSON* id, McpToolCallResult* r,
+                                   bool structured_only)
+{
+    bool text = !(structured_only && r->structured && !r->is_error);
+    bool any = false;
+    bool has_text = false;
+
+    write_jsonrpc_begin(out, id);
+    fputs("{\"content\":[", out);
+    for (McpContentItem* it = r->head; it != NULL; it = it->next) {
+        if (!text && it->type == MCP_CONTENT_TYPE_TEXT)
+            continue;
+        if (any)
+            fputc(',', out);
+        write_content_item(out, it);
+        any = true;
+        has_text |= it->type == MCP_CONTENT_TYPE_TEXT;
+    }
+    if (text && !has_text && r->structured) {
+        char* s = cJSON_PrintUnformatted(r->structured);
+        if (s) {
+            if (any)
+                fputc(',', out);
+            fputs("{\"type\":\"text\",\"text\":", out);
+            write_json_string(out, s);
+            fputc('}', out);
+            free(s);
+        }
+    }
+    fputc(']', out);
+    if (r->structured && atomic_load(&mcp_protocol_structured)) {
+        fputs(",\"structuredContent\":", out);
+        write_json_value(out, r->structured);
+    }
+    if (r->is_error)
+        fputs(",\"isError\":true", out);
+    fputs("}}\n", out);
+    fflush(out);
+}
+
+/* Record the response of one batch element, data being a single message as
+ * written to a memstream, or NULL for none. Takes data. */
+static void mcp_batch_answer(McpBatch* batch, int slot, char* data, size_t len)
+{
+    while (len > 0 && data[len-1] == '\n')
+        len--;
+
+    pthread_mutex_lock(&mcp_out_lock);
+    if (slot >= 0) {
+        batch->slots[slot].data = data;
+        batch->slots[slot].len = len;
+    }
+    if (--batch->pending > 0) {
+        pthread_mutex_unlock(&mcp_out_lock);
+        return;
+    }
+
+    /* Assembled first so the array goes out in one write */
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    int n = cJSON_GetArraySize(batch->requests);
+    bool any = false;
+    for (int i = 0; out && i < n; i++) {
+        if (!batch->slots[i].data)
+            continue;
+        fputc(any ? ',' : '[', out);
+        fwrite(batch->slots[i].data, 1, batch->slots[i].len, out);
+        any = true;
+    }
+    if (out) {
+        fputs("]\n", out);
+        fclose(out);
+    }
+    /* A batch of notifications gets no response at all */
+    if (any && buf) {
+        fwrite(buf, 1, size, mcp_out);
+        fflush(mcp_out);
+    }
+    pthread_mutex_unlock(&mcp_out_lock);
+
+    free(buf);
+    for (int i = 0; i < n; i++)
+        free(batch->slots[i].data);
+    free(batch->slots);
+    cJSON_Delete(batch->requests);
+    free(batch);
+}
+
+/* Write a tool call's response, or with a NULL result only settle its
+ * batch slot */
+static void mcp_call_respond(McpCallCtx* ctx, McpToolCallResult* result)
+{
+    McpToolCallResult* failed = NULL;
+    if (result && !mcp_content_streams_ready(result)) {
+        failed = mcp_tool_call_result_create();
+        if (failed) {
+            mcp_tool_call_result_set_error(failed);
+            mcp_tool_call_result_add_text(failed, "Content changed size while being read");
+            result = failed;
+        }
+    }
+
+    if (ctx->batch == NULL) {
+        if (result) {
+            pthread_mutex_lock(&mcp_out_lock);
+            write_tool_call_result(mcp_out, ctx->id, result, ctx->structured_only);
+            pthread_mutex_unlock(&mcp_out_lock);
+        }
+        mcp_tool_call_result_delete(failed);
+        return;
+    }
+
+    char* data = NULL;
+    size_t len = 0;
+    if (result) {
+        FILE* out = open_memstream(&data, &len);
+        if (out) {
+            write_tool_call_result(out, ctx->id, result, ctx->structured_only);
+            fclose(out);
+        }
+    }
+    mcp_tool_call_result_delete(failed);
+    mcp_batch_answer(ctx->batch, ctx->slot, data, len);
+}
+
 void mcp_set_name(const char* name)
 {
     mcp_server_name = name;
@@ -77,6 +576,147 @@ void mcp_set_version(const char* version)
     mcp_server_version = version;
 }
 
+static const char* schema_type_to_string(McpInputSchemaTypeEnum t)
+{
+    switch (t) {
+        case MCP_INPUT_SCHEMA_TYPE_NUMBER: return "number";
+        case MCP_INPUT_SCHEMA_TYPE_STRING: return "string";
+        case MCP_INPUT_SCHEMA_TYPE_BOOL:   return "boolean";
+        case MCP_INPUT_SCHEMA_TYPE_ARRAY:  return "array";
+        case MCP_INPUT_SCHEMA_TYPE_OBJECT: return "object";
+        case MCP_INPUT_SCHEMA_TYPE_NULL:   return "null";
+        default: return "unknown";
+    }
+}
+
+static McpArgProgram mcp_args_compile(const McpInputSchema* schema)
+{
+    McpArgProgram prog = { NULL, 0 };
+    if (schema->type != MCP_INPUT_SCHEMA_TYPE_OBJECT)
+        return prog;
+
+    int cap = 0;
+    for (const McpInputSchema* p = schema->properties; p && p->type != MCP_INPUT_SCHEMA_TYPE_NULL; p++)
+        cap++;
+    for (const char** r = schema->required; r && *r; r++)
+        cap++;
+    if (cap == 0 || (prog.checks = calloc(cap, sizeof(McpArgCheck))) == NULL)
+        return prog;
+
+    for (const McpInputSchema* p = schema->properties; p && p->type != MCP_INPUT_SCHEMA_TYPE_NULL; p++) {
+        McpArgCheck* c = &prog.checks[prog.n++];
+        c->name = p->name;
+        c->types = p->type;
+        if (p->bind != MCP_ARG_NONE)
+            c->bind = p;
+        if (p->type == MCP_INPUT_SCHEMA_TYPE_ARRAY)
+            c->item_types = p->properties ? p->properties->type : p->type_arr;
+    }
+    for (const char** r = schema->required; r && *r; r++) {
+        int i = 0;
+        while (i < prog.n && !(prog.checks[i].name && strcmp(prog.checks[i].name, *r) == 0))
+            i++;
+        if (i == prog.n)
+            prog.checks[prog.n++].name = *r;
+        prog.checks[i].required = true;
+    }
+    return prog;
+}
+
+static unsigned int mcp_json_type(const cJSON* v)
+{
+    if (cJSON_IsNumber(v)) return MCP_INPUT_SCHEMA_TYPE_NUMBER;
+    if (cJSON_IsString(v)) return MCP_INPUT_SCHEMA_TYPE_STRING;
+    if (cJSON_IsBool(v))   return MCP_INPUT_SCHEMA_TYPE_BOOL;
+    if (cJSON_IsArray(v))  return MCP_INPUT_SCHEMA_TYPE_ARRAY;
+    if (cJSON_IsObject(v)) return MCP_INPUT_SCHEMA_TYPE_OBJECT;
+    return MCP_INPUT_SCHEMA_TYPE_NULL;
+}
+
+/* Check arguments in one pass over them, filling slots[i] with the value
+ * of check i, or NULL when it is absent. A null value counts as absent
+ * unless required. Returns false with a message in err on a mismatch. */
+static bool mcp_args_check(const McpArgProgram* prog, cJSON* arguments, cJSON** slots,
+                           char* err, size_t errlen)
+{
+    if (arguments && !cJSON_IsObject(arguments)) {
+        snprintf(err, errlen, "arguments must be an object");
+        return false;
+    }
+
+    cJSON* v = NULL;
+    cJSON_ArrayForEach(v, arguments) {
+        int i = 0;
+        while (i < prog->n && !(prog->checks[i].name && strcmp(prog->checks[i].name, v->string) == 0))
+            i++;
+        if (i == prog->n || slots[i])
+            continue;
+        const McpArgCheck* c = &prog->checks[i];
+        if (cJSON_IsNull(v) && !c->required)
+            continue;
+
+        if (c->types && !(c->types & mcp_json_type(v))) {
+            snprintf(err, errlen, "%s must be of type %s", c->name,
+                     schema_type_to_string(c->types));
+            return false;
+        }
+        if (c->item_types && cJSON_IsArray(v)) {
+            cJSON* item = NULL;
+            int k = 0;
+            cJSON_ArrayForEach(item, v) {
+                if (!(c->item_types & mcp_json_type(item))) {
+                    snprintf(err, errlen, "%s[%d] must be of type %s", c->name, k,
+                             schema_type_to_string(c->item_types));
+                    return false;
+                }
+                k++;
+            }
+        }
+        slots[i] = v;
+    }
+
+    for (int i = 0; i < prog->n; i++) {
+        if (prog->checks[i].required && !slots[i]) {
+            snprintf(err, errlen, "missing required argument %s", prog->checks[i].name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Decode checked arguments into the handler's struct, defaults for those
+ * absent */
+static void mcp_args_bind(const McpArgProgram* prog, cJSON** slots, char* args)
+{
+    for (int i = 0; i < prog->n; i++) {
+        const McpInputSchema* b = prog->checks[i].bind;
+        if (b == NULL)
+            continue;
+
+        cJSON* v = slots[i];
+        char* field = args + b->offset;
+        switch (b->bind) {
+            case MCP_ARG_INT:
+                *(int*)field = cJSON_IsNumber(v) ? v->valueint : (int)b->def_number;
+                break;
+            case MCP_ARG_DOUBLE:
+                *(double*)field = cJSON_IsNumber(v) ? v->valuedouble : b->def_number;
+                break;
+            case MCP_ARG_BOOL:
+                *(bool*)field = cJSON_IsBool(v) ? cJSON_IsTrue(v) : b->def_number != 0;
+                break;
+            case MCP_ARG_STRING:
+                *(const char**)field = cJSON_IsString(v) ? v->valuestring : b->def_string;
+                break;
+            case MCP_ARG_JSON:
+                *(cJSON**)field = v;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 void mcp_add_tool(const McpTool* tool)
 {
     static int n = 0;
@@ -85,6 +725,7 @@ void mcp_add_tool(const McpTool* tool)
         return;
     }
 
+    mcp_server_programs[n] = mcp_args_compile(&tool->input_schema);
     mcp_server_tools[n++] = *tool;
 }
 
@@ -92,12 +733,17 @@ void mcp_add_tool(const McpTool* tool)
 
 static cJSON* jsonrpc_initialize(cJSON* params)
 {
-    (void)params;
-
     cJSON* response = cJSON_CreateObject();
 
-    /* Protocol version */
-    cJSON_AddStringToObject(response, "protocolVersion", "2025-03-26");
+    /* The client's protocol version if spoken, else the newest one */
+    cJSON* requested = cJSON_Select(params, ".protocolVersion:s");
+    const char* version = mcp_protocol_versions[0];
+    for (int i = 0; requested && mcp_protocol_versions[i]; i++) {
+        if (strcmp(requested->valuestring, mcp_protocol_versions[i]) == 0)
+            version = mcp_protocol_versions[i];
+    }
+    atomic_store(&mcp_protocol_structured, strcmp(version, "2025-06-18") >= 0);
+    cJSON_AddStringToObject(response, "protocolVersion", version);
 
     /* Server capabilities */
     cJSON* capabilities = cJSON_CreateObject();
@@ -118,19 +764,6 @@ static cJSON* jsonrpc_initialize(cJSON* params)
     return response;
 }
 
-static const char* schema_type_to_string(McpInputSchemaTypeEnum t)
-{
-    switch (t) {
-        case MCP_INPUT_SCHEMA_TYPE_NUMBER: return "number";
-        case MCP_INPUT_SCHEMA_TYPE_STRING: return "string";
-        case MCP_INPUT_SCHEMA_TYPE_BOOL:   return "boolean";
-        case MCP_INPUT_SCHEMA_TYPE_ARRAY:  return "array";
-        case MCP_INPUT_SCHEMA_TYPE_OBJECT: return "object";
-        case MCP_INPUT_SCHEMA_TYPE_NULL:   return "null";
-        default: return "unknown";
-    }
-}
-
 /* Convert internal McpInputSchema to a cJSON object representing the schema.
    Returns a new cJSON object or NULL if schema is null/empty. */
 static cJSON* mcp_input_schema_marshal(const McpInputSchema* s)
@@ -193,124 +826,1141 @@ static cJSON* jsonrpc_tools_list(cJSON* params)
         cJSON* schema_json = mcp_input_schema_marshal(&i->input_schema);
         if (schema_json)
             cJSON_AddItemToObject(tool, "inputSchema", schema_json);
+        schema_json = atomic_load(&mcp_protocol_structured)
+                      ? mcp_input_schema_marshal(&i->output_schema) : NULL;
+        if (schema_json)
+            cJSON_AddItemToObject(tool, "outputSchema", schema_json);
     }
     return response;
 }
 
-static cJSON* jsonrpc_tools_call(cJSON* params)
+static bool jsonrpc_id_equal(const cJSON* a, const cJSON* b)
+{
+    if (cJSON_IsNumber(a) && cJSON_IsNumber(b))
+        return a->valuedouble == b->valuedouble;
+    if (cJSON_IsString(a) && cJSON_IsString(b))
+        return strcmp(a->valuestring, b->valuestring) == 0;
+    return false;
+}
+
+static long long mcp_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool mcp_call_cancelled(const McpCallCtx* ctx)
 {
-    cJSON* name = cJSON_Select(params, ".name:s");
-    if (!name)
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    return ctx && atomic_load(&ctx->cancelled);
+}
+
+long mcp_call_remaining_ms(const McpCallCtx* ctx)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    if (ctx == NULL || ctx->deadline == 0)
+        return -1;
+    long long left = ctx->deadline - mcp_now_ms();
+    return left > 0 ? (long)left : 0;
+}
+
+cJSON* mcp_call_arg(const McpCallCtx* ctx, int i)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    if (ctx == NULL || i < 0 || i >= ctx->nargs)
         return NULL;
+    return ctx->args[i];
+}
 
-    cJSON* args = cJSON_GetObjectItem(params, "arguments");
+const void* mcp_call_args(const McpCallCtx* ctx)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    return ctx ? ctx->bound : NULL;
+}
 
-    for (McpTool* i = mcp_server_tools; i->name; i++) {
-        if (strcmp(i->name, name->valuestring) != 0)
-            continue;
+bool mcp_call_wants_text(const McpCallCtx* ctx)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    return ctx == NULL || !ctx->structured_only;
+}
 
-        McpToolCallResult* result = i->handler(args);
-        if (!result)
-            return NULL;
+bool mcp_call_wants_progress(const McpCallCtx* ctx)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    return ctx && ctx->progress_token;
+}
 
-        cJSON* result_obj = cJSON_CreateObject();
-        cJSON* content = cJSON_AddArrayToObject(result_obj, "content");
-
-        McpContentItem* it;
-        for (it = result->head; it != NULL; it = it->next) {
-            cJSON* content_obj = cJSON_CreateObject();
-            if (it->type == MCP_CONTENT_TYPE_TEXT) {
-                cJSON_AddStringToObject(content_obj, "type", "text");
-                cJSON_AddStringToObject(content_obj, "text", it->text ? it->text : "");
-            } else if (it->type == MCP_CONTENT_TYPE_IMAGE) {
-                cJSON_AddStringToObject(content_obj, "type", "image");
-                cJSON_AddStringToObject(content_obj, "data", it->data ? it->data : "");
-                cJSON_AddStringToObject(content_obj, "mimeType", it->mime_type ? it->mime_type : "");
-            } else {
-                cJSON_AddStringToObject(content_obj, "type", "unknown");
-            }
-            cJSON_AddItemToArray(content, content_obj);
-        }
+/* Progress must grow with each notification, so reports that do not are
+ * dropped, and plain ones are throttled. Content is always sent. */
+static void mcp_call_notify_progress(McpCallCtx* ctx, double done, double total,
+                                     const char* msg, McpToolCallResult* partial)
+{
+    if (ctx == NULL)
+        ctx = mcp_current_call;
+    if (ctx == NULL || ctx->progress_token == NULL)
+        return;
+    if (atomic_load(&ctx->cancelled) || atomic_load(&ctx->responded))
+        return;
+    if (partial && partial->head == NULL)
+        partial = NULL;
 
-        if (result->is_error)
-            cJSON_AddBoolToObject(result_obj, "isError", cJSON_True);
+    char* token = cJSON_PrintUnformatted(ctx->progress_token);
+    if (token == NULL)
+        return;
 
-        mcp_tool_call_result_delete(result);
-        return result_obj;
+    pthread_mutex_lock(&mcp_out_lock);
+    long long now = mcp_now_ms();
+    bool last = total > 0 && done >= total;
+    bool send = partial || (done > ctx->progress &&
+                            (last || now - ctx->progress_at >= MCP_PROGRESS_INTERVAL_MS));
+    if (send) {
+        fprintf(mcp_out, "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\","
+                         "\"params\":{\"progressToken\":%s,\"progress\":%.15g", token, done);
+        if (total > 0)
+            fprintf(mcp_out, ",\"total\":%.15g", total);
+        if (msg) {
+            fputs(",\"message\":", mcp_out);
+            write_json_string(mcp_out, msg);
+        }
+        if (partial) {
+            fputs(",\"content\":[", mcp_out);
+            for (McpContentItem* it = partial->head; it != NULL; it = it->next) {
+                if (it != partial->head)
+                    fputc(',', mcp_out);
+                write_content_item(mcp_out, it);
+            }
+            fputc(']', mcp_out);
+        }
+        fputs("}}\n", mcp_out);
+        fflush(mcp_out);
+        if (done > ctx->progress)
+            ctx->progress = done;
+        ctx->progress_at = now;
     }
-
-    return NULL;
+    pthread_mutex_unlock(&mcp_out_lock);
+    free(token);
 }
 
-static cJSON* jsonrpc_notifications_initialized(cJSON* params)
+void mcp_call_progress(McpCallCtx* ctx, double done, double total, const char* msg)
 {
-    (void)params;
-    return NULL;
+    mcp_call_notify_progress(ctx, done, total, msg, NULL);
 }
 
-static cJSON* handle_request(cJSON* request)
+void mcp_call_progress_content(McpCallCtx* ctx, double done, double total,
+                               McpToolCallResult* partial)
 {
-    cJSON* method = cJSON_Select(request, ".method:s");
-    if (!method)
-        return NULL;
+    mcp_call_notify_progress(ctx, done, total, NULL, partial);
+}
 
-    cJSON* id = cJSON_GetObjectItem(request, "id");
-    cJSON* params = cJSON_GetObjectItem(request, "params");
+void mcp_call_complete(McpCallCtx* ctx, McpToolCallResult* result)
+{
+    /* A cancelled request gets no response, one that timed out already got
+     * its error */
+    if (!atomic_exchange(&ctx->responded, true))
+        mcp_call_respond(ctx, atomic_load(&ctx->cancelled) ? NULL : result);
+    mcp_tool_call_result_delete(result);
+
+    pthread_mutex_lock(&mcp_calls_lock);
+    McpCallCtx** p = &mcp_calls;
+    while (*p != ctx)
+        p = &(*p)->next;
+    *p = ctx->next;
+    pthread_cond_broadcast(&mcp_calls_cond);
+    pthread_mutex_unlock(&mcp_calls_lock);
+
+    cJSON_Delete(ctx->id);
+    cJSON_Delete(ctx->params);
+    free(ctx->args);
+    free(ctx->bound);
+    free(ctx);
+}
 
-    for (JsonrpcMethod* i = jsonrpc_methods; i->name; i++) {
-        if (strcmp(method->valuestring, i->name) != 0)
-            continue;
+/* Every call gets a context, which takes the request's id and params so
+ * they outlive the request. Synchronous handlers find theirs through
+ * mcp_call_cancelled(NULL). */
+static bool jsonrpc_tools_call(cJSON* request, McpBatch* batch, int slot)
+{
+    cJSON* name = cJSON_Select(request, ".params.name:s");
+    McpTool* tool = mcp_server_tools;
+    while (name && tool->name && strcmp(tool->name, name->valuestring) != 0)
+        tool++;
+    if (!name || !tool->name) {
+        char message[300];
+        snprintf(message, sizeof(message), name ? "Unknown tool: %.200s" : "Invalid params: name is required",
+                 name ? name->valuestring : "");
+        mcp_reply_error(cJSON_GetObjectItem(request, "id"), JSONRPC_INVALID_PARAMS, message,
+                        batch, slot);
+        return true;
+    }
 
-        cJSON* result = i->handler(params);
-        if (!result)
-            return NULL;
+    /* Arguments not matching the schema are refused before the handler
+     * ever sees them */
+    const McpArgProgram* prog = &mcp_server_programs[tool - mcp_server_tools];
+    cJSON** args = prog->n ? calloc(prog->n, sizeof(cJSON*)) : NULL;
+    if (prog->n && args == NULL)
+        return false;
+    char err[256];
+    if (!mcp_args_check(prog, cJSON_Select(request, ".params.arguments"), args, err, sizeof(err))) {
+        free(args);
+        char message[300];
+        snprintf(message, sizeof(message), "Invalid params: %s", err);
+        mcp_reply_error(cJSON_GetObjectItem(request, "id"), JSONRPC_INVALID_PARAMS, message,
+                        batch, slot);
+        return true;
+    }
 
-        cJSON* response = cJSON_CreateObject();
-        cJSON_AddStringToObject(response, "jsonrpc", "2.0");
-        cJSON_AddItemReferenceToObject(response, "id", id);
-        cJSON_AddItemToObject(response, "result", result);
-        return response;
+    McpCallCtx* ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        free(args);
+        return false;
+    }
+    ctx->batch = batch;
+    ctx->slot = slot;
+    ctx->args = args;
+    ctx->nargs = prog->n;
+    if (tool->args_size) {
+        ctx->bound = calloc(1, tool->args_size);
+        if (ctx->bound == NULL) {
+            free(args);
+            free(ctx);
+            return false;
+        }
+        mcp_args_bind(prog, args, ctx->bound);
+    }
+    ctx->id = cJSON_DetachItemFromObject(request, "id");
+    ctx->params = cJSON_DetachItemFromObject(request, "params");
+    ctx->progress_token = cJSON_Select(ctx->params, "._meta.progressToken");
+    if (!cJSON_IsString(ctx->progress_token) && !cJSON_IsNumber(ctx->progress_token))
+        ctx->progress_token = NULL;
+    ctx->structured_only = atomic_load(&mcp_protocol_structured) &&
+                           cJSON_IsTrue(cJSON_Select(ctx->params, "._meta.structuredOnly"));
+    ctx->progress = -1;
+    atomic_init(&ctx->cancelled, false);
+    atomic_init(&ctx->responded, false);
+    ctx->timeout_ms = tool->timeout_ms ? tool->timeout_ms : mcp_default_timeout;
+    if (ctx->timeout_ms)
+        ctx->deadline = mcp_now_ms() + ctx->timeout_ms;
+
+    pthread_mutex_lock(&mcp_calls_lock);
+    ctx->next = mcp_calls;
+    mcp_calls = ctx;
+    if (ctx->deadline)
+        pthread_cond_broadcast(&mcp_calls_cond);
+    pthread_mutex_unlock(&mcp_calls_lock);
+
+    cJSON* arguments = cJSON_GetObjectItem(ctx->params, "arguments");
+    if (mcp_call_enter)
+        mcp_call_enter();
+    if (tool->async_handler) {
+        tool->async_handler(ctx, arguments);
+        if (mcp_call_leave)
+            mcp_call_leave();
+        return true;
     }
 
-    /* TODO: return error message */
-    return NULL;
+    mcp_current_call = ctx;
+    McpToolCallResult* result = tool->typed_handler ? tool->typed_handler(ctx->bound)
+                                                    : tool->handler(arguments);
+    mcp_current_call = NULL;
+    if (mcp_call_leave)
+        mcp_call_leave();
+    mcp_call_complete(ctx, result);
+    return true;
 }
 
-void mcp_main(int argc, const char** argv)
+/* Answer a call past its deadline with an error and cancel it, so that its
+ * handler stops and its transfers are aborted. Called with mcp_calls_lock
+ * held, which is dropped while the error is written since that may wait
+ * for the client. The call may complete and be freed meanwhile, so what
+ * the answer needs is copied first. */
+static void mcp_call_time_out(McpCallCtx* ctx)
 {
-    (void)argc;
-    (void)argv;
+    if (atomic_load(&ctx->cancelled) || atomic_exchange(&ctx->responded, true))
+        return;
+    atomic_store(&ctx->cancelled, true);
+
+    McpCallCtx answer = {
+        .id = cJSON_Duplicate(ctx->id, true),
+        .batch = ctx->batch,
+        .slot = ctx->slot,
+        .structured_only = ctx->structured_only,
+    };
+    unsigned int timeout_ms = ctx->timeout_ms;
+    pthread_mutex_unlock(&mcp_calls_lock);
+
+    McpToolCallResult* result = mcp_tool_call_result_create();
+    if (result) {
+        mcp_tool_call_result_set_error(result);
+        mcp_tool_call_result_add_textf(result, "Tool call timed out after %u ms", timeout_ms);
+    }
+    /* Without a result a batch slot is still settled */
+    mcp_call_respond(&answer, result);
+    mcp_tool_call_result_delete(result);
+    cJSON_Delete(answer.id);
 
-    while (1) {
-        char* message = read_jsonrpc_message(stdin);
-        if (!message)
-            break;
+    pthread_mutex_lock(&mcp_calls_lock);
+}
 
-        cJSON* request = cJSON_Parse(message);
-        free(message);
-        if (!request)
+static void* mcp_watchdog_main(void* arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&mcp_calls_lock);
+    while (!mcp_watchdog_stop) {
+        long long now = mcp_now_ms();
+        long long next = 0;
+        McpCallCtx* expired = NULL;
+        for (McpCallCtx* ctx = mcp_calls; ctx && !expired; ctx = ctx->next) {
+            if (ctx->deadline == 0 || atomic_load(&ctx->responded) || atomic_load(&ctx->cancelled))
+                continue;
+            if (ctx->deadline <= now)
+                expired = ctx;
+            else if (next == 0 || ctx->deadline < next)
+                next = ctx->deadline;
+        }
+
+        /* The list may change while the lock is dropped, so scan again */
+        if (expired) {
+            mcp_call_time_out(expired);
             continue;
+        }
 
-        cJSON* response = handle_request(request);
-        if (response) {
-            write_jsonrpc_message(stdout, response);
-            free(response);
+        if (next == 0) {
+            pthread_cond_wait(&mcp_calls_cond, &mcp_calls_lock);
+            continue;
         }
 
-        free(request);
+        /* The condition variable waits on the realtime clock */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        long long ns = ts.tv_nsec + (next - now) * 1000000LL;
+        ts.tv_sec += ns / 1000000000LL;
+        ts.tv_nsec = ns % 1000000000LL;
+        pthread_cond_timedwait(&mcp_calls_cond, &mcp_calls_lock, &ts);
     }
+    pthread_mutex_unlock(&mcp_calls_lock);
+    return NULL;
 }
 
-McpToolCallResult* mcp_tool_call_result_create()
+/* Runs on the reader thread, so that a call blocking the dispatcher can
+ * still be cancelled. A request not started yet is dropped. */
+static void jsonrpc_notifications_cancelled(cJSON* params)
 {
-    McpToolCallResult* r = malloc(sizeof(McpToolCallResult));
-    if (r == NULL)
-        return NULL;
+    cJSON* id = cJSON_GetObjectItem(params, "requestId");
+    if (!id)
+        return;
 
-    r->is_error = false;
-    r->head = NULL;
-    r->tail = NULL;
-    return r;
+    pthread_mutex_lock(&mcp_calls_lock);
+    for (McpCallCtx* ctx = mcp_calls; ctx; ctx = ctx->next) {
+        if (jsonrpc_id_equal(ctx->id, id))
+            atomic_store(&ctx->cancelled, true);
+    }
+    pthread_mutex_unlock(&mcp_calls_lock);
+
+    pthread_mutex_lock(&mcp_requests_lock);
+    McpRequest* prev = NULL;
+    for (McpRequest* r = mcp_requests_head; r; ) {
+        McpRequest* next = r->next;
+        if (jsonrpc_id_equal(mcp_request_id(r), id)) {
+            if (prev)
+                prev->next = next;
+            else
+                mcp_requests_head = next;
+            if (mcp_requests_tail == r)
+                mcp_requests_tail = prev;
+            mcp_request_free(r);
+        } else {
+            prev = r;
+        }
+        r = next;
+    }
+    pthread_mutex_unlock(&mcp_requests_lock);
+}
+
+static cJSON* jsonrpc_notifications_initialized(cJSON* params)
+{
+    (void)params;
+    return NULL;
+}
+
+/* Answer with an error, if there is an id to answer. Settles the batch
+ * slot either way. */
+static void mcp_reply_error(cJSON* id, int code, const char* message, McpBatch* batch, int slot)
+{
+    char* data = NULL;
+    size_t len = 0;
+    char* id_str = id ? cJSON_PrintUnformatted(id) : NULL;
+    if (id_str && batch) {
+        FILE* out = open_memstream(&data, &len);
+        if (out) {
+            write_jsonrpc_error(out, id_str, strlen(id_str), code, message);
+            fclose(out);
+        }
+    } else if (id_str) {
+        pthread_mutex_lock(&mcp_out_lock);
+        write_jsonrpc_error(mcp_out, id_str, strlen(id_str), code, message);
+        pthread_mutex_unlock(&mcp_out_lock);
+    }
+    free(id_str);
+    if (batch)
+        mcp_batch_answer(batch, slot, data, len);
+}
+
+/* Answer a single request. Within a batch, the response goes to the
+ * batch's slot, which is settled even when there is none. */
+static void handle_request(cJSON* request, McpBatch* batch, int slot)
+{
+    cJSON* method = cJSON_Select(request, ".method:s");
+    cJSON* id = cJSON_GetObjectItem(request, "id");
+    cJSON* params = cJSON_GetObjectItem(request, "params");
+
+    /* An id can only be a string, a number or null */
+    if (id && !cJSON_IsString(id) && !cJSON_IsNumber(id) && !cJSON_IsNull(id)) {
+        cJSON* null_id = cJSON_CreateNull();
+        mcp_reply_error(null_id, JSONRPC_INVALID_REQUEST, "Invalid Request", batch, slot);
+        cJSON_Delete(null_id);
+        return;
+    }
+
+    JsonrpcMethod* i = jsonrpc_methods;
+    for (; method && i->name; i++) {
+        if (strcmp(method->valuestring, i->name) != 0)
+            continue;
+
+        if (i->call) {
+            if (!i->call(request, batch, slot) && batch)
+                mcp_batch_answer(batch, slot, NULL, 0);
+            return;
+        }
+
+        cJSON* result = i->handler(params);
+        if (!result)
+            break;
+
+        cJSON* response = cJSON_CreateObject();
+        cJSON_AddStringToObject(response, "jsonrpc", "2.0");
+        cJSON_AddItemReferenceToObject(response, "id", id);
+        cJSON_AddItemToObject(response, "result", result);
+        if (batch) {
+            char* data = cJSON_PrintUnformatted(response);
+            mcp_batch_answer(batch, slot, data, data ? strlen(data) : 0);
+        } else {
+            pthread_mutex_lock(&mcp_out_lock);
+            write_jsonrpc_message(mcp_out, response);
+            pthread_mutex_unlock(&mcp_out_lock);
+        }
+        cJSON_Delete(response);
+        return;
+    }
+
+    /* Requests for unknown methods get an error, notifications nothing.
+     * Without a method it is no request at all, answered with a null id
+     * if it has none. */
+    if (method && i->name)
+        id = NULL;
+    cJSON* null_id = !method && !id ? cJSON_CreateNull() : NULL;
+    mcp_reply_error(method ? id : id ? id : null_id,
+                    method ? JSONRPC_METHOD_NOT_FOUND : JSONRPC_INVALID_REQUEST,
+                    method ? "Method not found" : "Invalid Request", batch, slot);
+    cJSON_Delete(null_id);
+}
+
+static void* mcp_batch_worker(void* arg)
+{
+    McpBatch* batch = arg;
+    int n = cJSON_GetArraySize(batch->requests);
+    int i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < n)
+        handle_request(cJSON_GetArrayItem(batch->requests, i), batch, i);
+    return NULL;
+}
+
+/* Dispatch the elements of a batch, on several threads if
+ * mcp_set_batch_parallel() allows, and return once they are all started.
+ * Async calls may still be running; the response is written by whoever
+ * answers last. */
+static void handle_batch(cJSON* requests)
+{
+    int n = cJSON_GetArraySize(requests);
+    if (n == 0) {
+        /* An empty array is an invalid request, not an empty batch */
+        cJSON* null_id = cJSON_CreateNull();
+        mcp_reply_error(null_id, JSONRPC_INVALID_REQUEST, "Invalid Request", NULL, 0);
+        cJSON_Delete(null_id);
+        cJSON_Delete(requests);
+        return;
+    }
+    McpBatch* batch = calloc(1, sizeof(*batch));
+    if (batch)
+        batch->slots = calloc(n > 0 ? n : 1, sizeof(*batch->slots));
+    if (batch == NULL || batch->slots == NULL) {
+        free(batch);
+        cJSON_Delete(requests);
+        return;
+    }
+    batch->requests = requests;
+    /* One extra for the dispatcher, so the batch outlives this function */
+    batch->pending = n + 1;
+    atomic_init(&batch->next, 0);
+
+    int nthreads = mcp_batch_parallel < n ? mcp_batch_parallel : n;
+    pthread_t* threads = nthreads > 1 ? calloc(nthreads - 1, sizeof(pthread_t)) : NULL;
+    int started = 0;
+    while (threads && started < nthreads - 1 &&
+           pthread_create(&threads[started], NULL, mcp_batch_worker, batch) == 0)
+        started++;
+    mcp_batch_worker(batch);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    mcp_batch_answer(batch, -1, NULL, 0);
+}
+
+/*
+ * Envelope scanning
+ *
+ * The reader routes a request by its top level members alone. Values are
+ * checked against the JSON grammar and stepped over, not parsed, so the
+ * arguments of a tools/call are parsed once it is dispatched, and never if
+ * it is rejected or cancelled first. Anything unusual (batches, escaped
+ * method names, ids that are no string, number or null) or malformed takes
+ * the full parse, which answers what it cannot read.
+ */
+
+static const char* json_skip_ws(const char* p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+    return p;
+}
+
+static bool json_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static const char* json_skip_string(const char* p)
+{
+    for (p++; *p != '"'; p++) {
+        if ((unsigned char)*p < 0x20)
+            return NULL;
+        if (*p != '\\')
+            continue;
+        p++;
+        if (*p == 'u') {
+            for (int i = 0; i < 4; i++) {
+                char c = *++p;
+                if (!json_is_digit(c) && !(c >= 'a' && c <= 'f') && !(c >= 'A' && c <= 'F'))
+                    return NULL;
+            }
+        } else if (*p == '\0' || !strchr("\"\\/bfnrt", *p)) {
+            return NULL;
+        }
+    }
+    return p + 1;
+}
+
+static const char* json_skip_number(const char* p)
+{
+    if (*p == '-')
+        p++;
+    if (*p == '0')
+        p++;
+    else if (json_is_digit(*p))
+        while (json_is_digit(*p))
+            p++;
+    else
+        return NULL;
+    if (*p == '.') {
+        if (!json_is_digit(*++p))
+            return NULL;
+        while (json_is_digit(*p))
+            p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-')
+            p++;
+        if (!json_is_digit(*p))
+            return NULL;
+        while (json_is_digit(*p))
+            p++;
+    }
+    return p;
+}
+
+static const char* json_skip_nested(const char* p, int depth);
+
+/* Members or elements up to the closing bracket, p just past the opening one */
+static const char* json_skip_container(const char* p, char close, int depth)
+{
+    p = json_skip_ws(p);
+    if (*p == close)
+        return p + 1;
+
+    while (1) {
+        if (close == '}') {
+            if (*p != '"' || !(p = json_skip_string(p)))
+                return NULL;
+            p = json_skip_ws(p);
+            if (*p++ != ':')
+                return NULL;
+            p = json_skip_ws(p);
+        }
+        p = json_skip_nested(p, depth);
+        if (!p)
+            return NULL;
+        p = json_skip_ws(p);
+        if (*p == close)
+            return p + 1;
+        if (*p++ != ',')
+            return NULL;
+        p = json_skip_ws(p);
+    }
+}
+
+static const char* json_skip_nested(const char* p, int depth)
+{
+    switch (*p) {
+        case '"':
+            return json_skip_string(p);
+        case '{':
+        case '[':
+            if (depth >= CJSON_NESTING_LIMIT)
+                return NULL;
+            return json_skip_container(p + 1, *p == '{' ? '}' : ']', depth + 1);
+        case 't':
+            return strncmp(p, "true", 4) == 0 ? p + 4 : NULL;
+        case 'f':
+            return strncmp(p, "false", 5) == 0 ? p + 5 : NULL;
+        case 'n':
+            return strncmp(p, "null", 4) == 0 ? p + 4 : NULL;
+        default:
+            return json_skip_number(p);
+    }
+}
+
+/* Step over one value, NULL if it is not valid JSON */
+static const char* json_skip_value(const char* p)
+{
+    return json_skip_nested(p, 0);
+}
+
+/* Walk the object at p, filling in the spans of the members named in keys
+ * (NULL terminated), first one wins. Returns the end of the object, NULL
+ * if it is malformed. */
+static const char* json_scan_object(const char* p, const char* const* keys, McpSpan* spans)
+{
+    p = json_skip_ws(p);
+    if (*p++ != '{')
+        return NULL;
+    p = json_skip_ws(p);
+    if (*p == '}')
+        return p + 1;
+
+    while (1) {
+        if (*p != '"')
+            return NULL;
+        const char* key = p + 1;
+        p = json_skip_string(p);
+        if (!p)
+            return NULL;
+        size_t key_len = p - 1 - key;
+
+        p = json_skip_ws(p);
+        if (*p++ != ':')
+            return NULL;
+        p = json_skip_ws(p);
+        const char* value = p;
+        p = json_skip_value(p);
+        if (!p)
+            return NULL;
+
+        for (int i = 0; keys[i]; i++) {
+            if (spans[i].p == NULL && strlen(keys[i]) == key_len &&
+                memcmp(keys[i], key, key_len) == 0) {
+                spans[i].p = value;
+                spans[i].len = p - value;
+            }
+        }
+
+        p = json_skip_ws(p);
+        if (*p == '}')
+            return p + 1;
+        if (*p++ != ',')
+            return NULL;
+        p = json_skip_ws(p);
+    }
+}
+
+/* True if span is the JSON string s, unescaped */
+static bool mcp_span_is(McpSpan span, const char* s)
+{
+    size_t len = strlen(s);
+    return span.p && span.len == len + 2 && span.p[0] == '"' &&
+           memcmp(span.p + 1, s, len) == 0;
+}
+
+static bool mcp_envelope_scan(const char* message, McpEnvelope* env)
+{
+    static const char* const keys[] = { "jsonrpc", "id", "method", "params", NULL };
+    static const char* const params_keys[] = { "name", NULL };
+
+    McpSpan spans[4] = {{0}};
+    memset(env, 0, sizeof(*env));
+    const char* end = json_scan_object(message, keys, spans);
+    if (!end || *json_skip_ws(end) != '\0')
+        return false;
+    env->jsonrpc = spans[0];
+    env->id = spans[1];
+    env->method = spans[2];
+    env->params = spans[3];
+    /* The id is written back as it came, so only plain ones are taken */
+    if (env->id.p && env->id.p[0] != '"' && env->id.p[0] != 'n' && env->id.p[0] != '-' &&
+        !json_is_digit(env->id.p[0]))
+        return false;
+    if (!env->method.p || env->method.p[0] != '"' ||
+        memchr(env->method.p, '\\', env->method.len))
+        return false;
+    if (env->params.p && env->params.p[0] == '{' &&
+        !json_scan_object(env->params.p, params_keys, &env->name))
+        return false;
+    return true;
+}
+
+/* Settle what can be without a parse. Returns false if the request needs
+ * no dispatching. Errors are left to the dispatcher to write, so reading
+ * never waits on the output. */
+static bool mcp_envelope_route(McpRequest* r)
+{
+    const McpEnvelope* env = &r->env;
+    if (env->jsonrpc.p && !mcp_span_is(env->jsonrpc, "2.0")) {
+        r->error = JSONRPC_INVALID_REQUEST;
+        return env->id.p != NULL;
+    }
+
+    if (mcp_span_is(env->method, "notifications/cancelled")) {
+        cJSON* params = env->params.p ? cJSON_ParseWithLength(env->params.p, env->params.len) : NULL;
+        jsonrpc_notifications_cancelled(params);
+        cJSON_Delete(params);
+        return false;
+    }
+
+    for (JsonrpcMethod* i = jsonrpc_methods; i->name; i++) {
+        if (mcp_span_is(env->method, i->name))
+            return true;
+    }
+    r->error = JSONRPC_METHOD_NOT_FOUND;
+    return env->id.p != NULL;
+}
+
+/* Build the cJSON request of a scanned one. A tools/call naming no known
+ * tool is answered here, before its arguments are parsed. */
+static cJSON* mcp_request_parse(McpRequest* r)
+{
+    McpEnvelope* env = &r->env;
+    if (mcp_span_is(env->method, "tools/call") && env->name.p && env->name.p[0] == '"' &&
+        !memchr(env->name.p, '\\', env->name.len)) {
+        McpTool* tool = mcp_server_tools;
+        while (tool->name && !mcp_span_is(env->name, tool->name))
+            tool++;
+        if (!tool->name) {
+            char message[300];
+            snprintf(message, sizeof(message), "Unknown tool: %.*s",
+                     (int)(env->name.len - 2 < 200 ? env->name.len - 2 : 200), env->name.p + 1);
+            mcp_reply_error(r->id, JSONRPC_INVALID_PARAMS, message, NULL, 0);
+            return NULL;
+        }
+    }
+
+    cJSON* request = cJSON_CreateObject();
+    if (!request)
+        return NULL;
+    if (r->id) {
+        cJSON_AddItemToObject(request, "id", r->id);
+        r->id = NULL;
+    }
+    char* method = strndup(env->method.p + 1, env->method.len - 2);
+    cJSON_AddItemToObject(request, "method", cJSON_CreateString(method ? method : ""));
+    free(method);
+    if (env->params.p) {
+        cJSON* params = cJSON_ParseWithLength(env->params.p, env->params.len);
+        if (!params) {
+            mcp_reply_error(cJSON_GetObjectItem(request, "id"), JSONRPC_PARSE_ERROR,
+                            "Parse error", NULL, 0);
+            cJSON_Delete(request);
+            return NULL;
+        }
+        cJSON_AddItemToObject(request, "params", params);
+    }
+    return request;
+}
+
+/*
+ * Output
+ */
+
+static double mcp_elapsed_ms(const struct timespec* since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/* Wait until the output queue is back under the low watermark. Called
+ * with mcp_outq_lock held. */
+static void mcp_outq_wait_drained(bool reader)
+{
+    if (!mcp_outq_full)
+        return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (mcp_outq_full && !mcp_outq_closed)
+        pthread_cond_wait(&mcp_outq_cond, &mcp_outq_lock);
+    if (reader) {
+        mcp_outq_stats.reader_stalls++;
+        mcp_outq_stats.reader_stall_ms += mcp_elapsed_ms(&start);
+    }
+}
+
+/* Write function of mcp_out: queue a copy of what stdio flushed */
+static ssize_t mcp_outq_write(void* cookie, const char* buf, size_t len)
+{
+    (void)cookie;
+    McpOutChunk* c = malloc(sizeof(*c));
+    char* data = malloc(len);
+    if (!c || !data) {
+        free(c);
+        free(data);
+        return -1;
+    }
+    memcpy(data, buf, len);
+    c->data = data;
+    c->len = len;
+    c->next = NULL;
+
+    pthread_mutex_lock(&mcp_outq_lock);
+    /* A producer outrunning the client waits here, which bounds the queue
+     * by one stdio buffer per writer above the high watermark */
+    mcp_outq_wait_drained(false);
+    if (mcp_outq_tail)
+        mcp_outq_tail->next = c;
+    else
+        mcp_outq_head = c;
+    mcp_outq_tail = c;
+    mcp_outq_bytes += len;
+    mcp_outq_stats.queued_chunks++;
+    if (mcp_outq_bytes > mcp_outq_stats.max_queued_bytes)
+        mcp_outq_stats.max_queued_bytes = mcp_outq_bytes;
+    if (mcp_outq_bytes > mcp_outq_high)
+        mcp_outq_full = true;
+    pthread_cond_broadcast(&mcp_outq_cond);
+    pthread_mutex_unlock(&mcp_outq_lock);
+    return len;
+}
+
+/* stdout is left blocking, since stderr or other processes may share its
+ * file description. Time spent waiting for it to take more is a stall. */
+static void mcp_wait_writable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    if (poll(&pfd, 1, 0) != 0)
+        return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+        ;
+    double ms = mcp_elapsed_ms(&start);
+    pthread_mutex_lock(&mcp_outq_lock);
+    mcp_outq_stats.write_stalls++;
+    mcp_outq_stats.write_stall_ms += ms;
+    pthread_mutex_unlock(&mcp_outq_lock);
+}
+
+/* Write all of data to fd, false once the client is gone */
+static bool mcp_write_fd(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        mcp_wait_writable(fd);
+        ssize_t n = write(fd, data, len);
+        if (n > 0) {
+            data += n;
+            len -= n;
+            continue;
+        }
+        /* EAGAIN if whoever started us made stdout non-blocking */
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        return false;
+    }
+    return true;
+}
+
+static void* mcp_writer_main(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    bool broken = false;
+
+    pthread_mutex_lock(&mcp_outq_lock);
+    while (1) {
+        while (!mcp_outq_head && !mcp_outq_closed)
+            pthread_cond_wait(&mcp_outq_cond, &mcp_outq_lock);
+        McpOutChunk* c = mcp_outq_head;
+        if (!c)
+            break;
+        mcp_outq_head = c->next;
+        if (!mcp_outq_head)
+            mcp_outq_tail = NULL;
+        pthread_mutex_unlock(&mcp_outq_lock);
+
+        /* Once the client is gone, output is discarded */
+        if (!broken && !mcp_write_fd(fd, c->data, c->len)) {
+            fprintf(stderr, "Writing to stdout failed: %s\n", strerror(errno));
+            broken = true;
+        }
+
+        pthread_mutex_lock(&mcp_outq_lock);
+        mcp_outq_bytes -= c->len;
+        if (mcp_outq_full && mcp_outq_bytes <= mcp_outq_low) {
+            mcp_outq_full = false;
+            pthread_cond_broadcast(&mcp_outq_cond);
+        }
+        free(c->data);
+        free(c);
+    }
+    pthread_mutex_unlock(&mcp_outq_lock);
+    return NULL;
+}
+
+void mcp_set_output_watermarks(size_t high, size_t low)
+{
+    pthread_mutex_lock(&mcp_outq_lock);
+    mcp_outq_high = high;
+    mcp_outq_low = low < high ? low : high;
+    pthread_mutex_unlock(&mcp_outq_lock);
+}
+
+void mcp_get_output_stats(McpOutputStats* stats)
+{
+    pthread_mutex_lock(&mcp_outq_lock);
+    *stats = mcp_outq_stats;
+    stats->queued_bytes = mcp_outq_bytes;
+    pthread_mutex_unlock(&mcp_outq_lock);
+}
+
+static bool mcp_is_cancellation(cJSON* request)
+{
+    cJSON* method = cJSON_Select(request, ".method:s");
+    return method && strcmp(method->valuestring, "notifications/cancelled") == 0;
+}
+
+static void mcp_request_enqueue(McpRequest* r)
+{
+    r->next = NULL;
+    pthread_mutex_lock(&mcp_requests_lock);
+    if (mcp_requests_tail)
+        mcp_requests_tail->next = r;
+    else
+        mcp_requests_head = r;
+    mcp_requests_tail = r;
+    pthread_cond_signal(&mcp_requests_cond);
+    pthread_mutex_unlock(&mcp_requests_lock);
+}
+
+static void* mcp_reader_main(void* arg)
+{
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&mcp_outq_lock);
+        mcp_outq_wait_drained(true);
+        pthread_mutex_unlock(&mcp_outq_lock);
+
+        char* message = read_jsonrpc_message(stdin);
+        if (!message)
+            break;
+
+        McpRequest* r = calloc(1, sizeof(*r));
+        if (r == NULL) {
+            free(message);
+            continue;
+        }
+
+        if (mcp_envelope_scan(message, &r->env)) {
+            if (!mcp_envelope_route(r)) {
+                free(message);
+                free(r);
+                continue;
+            }
+            r->message = message;
+            if (r->env.id.p)
+                r->id = cJSON_ParseWithLength(r->env.id.p, r->env.id.len);
+            mcp_request_enqueue(r);
+            continue;
+        }
+
+        /* Its id is unknown, so the error goes out with a null one */
+        cJSON* request = cJSON_Parse(message);
+        free(message);
+        if (!request) {
+            r->error = JSONRPC_PARSE_ERROR;
+            r->env.id.p = "null";
+            r->env.id.len = 4;
+            mcp_request_enqueue(r);
+            continue;
+        }
+
+        if (mcp_is_cancellation(request)) {
+            jsonrpc_notifications_cancelled(cJSON_GetObjectItem(request, "params"));
+            cJSON_Delete(request);
+            free(r);
+            continue;
+        }
+        if (cJSON_IsArray(request)) {
+            for (cJSON* e = request->child; e; ) {
+                cJSON* next = e->next;
+                if (mcp_is_cancellation(e)) {
+                    jsonrpc_notifications_cancelled(cJSON_GetObjectItem(e, "params"));
+                    cJSON_Delete(cJSON_DetachItemViaPointer(request, e));
+                }
+                e = next;
+            }
+        }
+
+        r->json = request;
+        mcp_request_enqueue(r);
+    }
+
+    pthread_mutex_lock(&mcp_requests_lock);
+    mcp_requests_eof = true;
+    pthread_cond_signal(&mcp_requests_cond);
+    pthread_mutex_unlock(&mcp_requests_lock);
+    return NULL;
+}
+
+/* Next request to dispatch, NULL once the input is drained. Scanned
+ * requests are parsed here, off the reader thread. */
+static cJSON* mcp_next_request()
+{
+    while (1) {
+        pthread_mutex_lock(&mcp_requests_lock);
+        while (!mcp_requests_head && !mcp_requests_eof)
+            pthread_cond_wait(&mcp_requests_cond, &mcp_requests_lock);
+
+        McpRequest* r = mcp_requests_head;
+        if (r) {
+            mcp_requests_head = r->next;
+            if (!mcp_requests_head)
+                mcp_requests_tail = NULL;
+        }
+        pthread_mutex_unlock(&mcp_requests_lock);
+        if (!r)
+            return NULL;
+
+        if (r->error) {
+            pthread_mutex_lock(&mcp_out_lock);
+            write_jsonrpc_error(mcp_out, r->env.id.p, r->env.id.len, r->error,
+                                r->error == JSONRPC_METHOD_NOT_FOUND ? "Method not found"
+                                : r->error == JSONRPC_PARSE_ERROR ? "Parse error"
+                                : "Invalid Request");
+            pthread_mutex_unlock(&mcp_out_lock);
+            mcp_request_free(r);
+            continue;
+        }
+
+        cJSON* request = r->json;
+        r->json = NULL;
+        if (!request)
+            request = mcp_request_parse(r);
+        mcp_request_free(r);
+        if (request)
+            return request;
+    }
+}
+
+/* stdin is read on its own thread, which acts on cancellations right away
+ * and queues everything else for this one. */
+void mcp_main(int argc, const char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    /* Responses go through the output queue, written to stdout by a thread
+     * of their own */
+    int out_fd = fileno(stdout);
+    fflush(stdout);
+
+    cookie_io_functions_t io = { .write = mcp_outq_write };
+    mcp_out = fopencookie(NULL, "w", io);
+    pthread_t writer;
+    if (mcp_out == NULL ||
+        pthread_create(&writer, NULL, mcp_writer_main, (void*)(intptr_t)out_fd) != 0) {
+        fprintf(stderr, "Cannot start the writer thread\n");
+        return;
+    }
+    setvbuf(mcp_out, NULL, _IOFBF, MCP_OUT_BUFFER_SIZE);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, mcp_reader_main, NULL) != 0) {
+        fprintf(stderr, "Cannot start the reader thread\n");
+        return;
+    }
+    pthread_t watchdog;
+    bool watchdog_started = pthread_create(&watchdog, NULL, mcp_watchdog_main, NULL) == 0;
+    if (!watchdog_started)
+        fprintf(stderr, "Cannot start the watchdog thread, tool timeouts are off\n");
+
+    cJSON* request;
+    while ((request = mcp_next_request()) != NULL) {
+        if (cJSON_IsArray(request)) {
+            handle_batch(request);
+            continue;
+        }
+        handle_request(request, NULL, 0);
+        cJSON_Delete(request);
+    }
+    pthread_join(reader, NULL);
+
+    /* Let async calls still running deliver their results */
+    pthread_mutex_lock(&mcp_calls_lock);
+    while (mcp_calls)
+        pthread_cond_wait(&mcp_calls_cond, &mcp_calls_lock);
+    mcp_watchdog_stop = true;
+    pthread_cond_broadcast(&mcp_calls_cond);
+    pthread_mutex_unlock(&mcp_calls_lock);
+    if (watchdog_started)
+        pthread_join(watchdog, NULL);
+
+    fclose(mcp_out);
+    pthread_mutex_lock(&mcp_outq_lock);
+    mcp_outq_closed = true;
+    pthread_cond_broadcast(&mcp_outq_cond);
+    pthread_mutex_unlock(&mcp_outq_lock);
+    pthread_join(writer, NULL);
+    mcp_out = NULL;
+}
+
+McpToolCallResult* mcp_tool_call_result_create()
+{
+    McpToolCallResult* r = malloc(sizeof(McpToolCallResult));
+    if (r == NULL)
+        return NULL;
+
+    r->is_error = false;
+    r->head = NULL;
+    r->tail = NULL;
+    r->structured = NULL;
+    return r;
 }
 
 static void mcp_tool_call_result_add_content(McpToolCallResult* r, McpContentItem* i)
@@ -330,6 +1980,12 @@ static void mcp_content_item_delete(McpContentItem* i)
 {
     if (i == NULL) return;
     mcp_content_item_delete(i->next);
+    if (i->stream.close)
+        i->stream.close(i->stream.ctx);
+    free(i->text);
+    free(i->data);
+    free(i->mime_type);
+    free(i->uri);
     free(i);
 }
 
@@ -337,19 +1993,24 @@ void mcp_tool_call_result_delete(McpToolCallResult* r)
 {
     if (r == NULL) return;
     mcp_content_item_delete(r->head);
+    cJSON_Delete(r->structured);
     free(r);
 }
 
+void mcp_tool_call_result_set_structured(McpToolCallResult* r, cJSON* structured)
+{
+    cJSON_Delete(r->structured);
+    r->structured = structured;
+}
+
 bool mcp_tool_call_result_add_text(McpToolCallResult* r, const char* text)
 {
-    McpContentItem* i = (McpContentItem*)malloc(sizeof(McpContentItem));
+    McpContentItem* i = (McpContentItem*)calloc(1, sizeof(McpContentItem));
     if (i == NULL)
         return false;
 
     i->type = MCP_CONTENT_TYPE_TEXT;
     i->text = strdup(text);
-    i->data = NULL;
-    i->mime_type = NULL;
 
     mcp_tool_call_result_add_content(r, i);
     return true;
@@ -370,19 +2031,352 @@ bool mcp_tool_call_result_add_textf(McpToolCallResult* r, const char* fmt, ...)
 
 bool mcp_tool_call_result_add_image(McpToolCallResult* r, const char* data, const char* mime_type)
 {
-    McpContentItem* i = (McpContentItem*)malloc(sizeof(McpContentItem));
+    char* copy = strdup(data);
+    if (copy == NULL)
+        return false;
+
+    if (!mcp_tool_call_result_add_image_owned(r, copy, mime_type)) {
+        free(copy);
+        return false;
+    }
+    return true;
+}
+
+bool mcp_tool_call_result_add_image_owned(McpToolCallResult* r, char* data, const char* mime_type)
+{
+    McpContentItem* i = (McpContentItem*)calloc(1, sizeof(McpContentItem));
     if (i == NULL)
         return false;
 
     i->type = MCP_CONTENT_TYPE_IMAGE;
-    i->text = NULL;
-    i->data = strdup(data);
+    i->data = data;
     i->mime_type = strdup(mime_type);
 
     mcp_tool_call_result_add_content(r, i);
     return true;
 }
 
+bool mcp_tool_call_result_add_resource_link(McpToolCallResult* r, const char* uri,
+                                            const char* name, const char* mime_type,
+                                            size_t size)
+{
+    McpContentItem* i = (McpContentItem*)calloc(1, sizeof(McpContentItem));
+    if (i == NULL)
+        return false;
+
+    i->type = MCP_CONTENT_TYPE_RESOURCE_LINK;
+    i->uri = strdup(uri);
+    i->text = strdup(name ? name : uri);
+    i->mime_type = mime_type ? strdup(mime_type) : NULL;
+    i->stream.size = size;
+
+    mcp_tool_call_result_add_content(r, i);
+    return true;
+}
+
+void mcp_set_max_inline_size(size_t size)
+{
+    mcp_max_inline = size;
+}
+
+size_t mcp_get_max_inline_size(void)
+{
+    return mcp_max_inline;
+}
+
+void mcp_set_batch_parallel(int n)
+{
+    mcp_batch_parallel = n < 1 ? 1 : n;
+}
+
+void mcp_set_default_timeout(unsigned int ms)
+{
+    mcp_default_timeout = ms;
+}
+
+void mcp_set_call_hooks(void (*enter)(void), void (*leave)(void))
+{
+    mcp_call_enter = enter;
+    mcp_call_leave = leave;
+}
+
+bool mcp_tool_call_result_add_image_stream(McpToolCallResult* r,
+                                           const McpContentStream* stream,
+                                           const char* mime_type)
+{
+    /* Too big to inline, point the client at the resource instead */
+    if (mcp_max_inline && stream->size > mcp_max_inline && stream->uri) {
+        bool rc = mcp_tool_call_result_add_resource_link(r, stream->uri, stream->name,
+                                                         mime_type, stream->size);
+        if (stream->close)
+            stream->close(stream->ctx);
+        return rc;
+    }
+
+    McpContentItem* i = (McpContentItem*)calloc(1, sizeof(McpContentItem));
+    if (i == NULL)
+        return false;
+
+    i->type = MCP_CONTENT_TYPE_IMAGE;
+    i->mime_type = strdup(mime_type);
+    i->stream = *stream;
+    i->stream.uri = NULL;
+    i->stream.name = NULL;
+
+    mcp_tool_call_result_add_content(r, i);
+    return true;
+}
+
+static ssize_t mcp_fd_read(void* ctx, void* buf, size_t len)
+{
+    int fd = (int)(intptr_t)ctx;
+    ssize_t n;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static void mcp_fd_close(void* ctx)
+{
+    close((int)(intptr_t)ctx);
+}
+
+bool mcp_tool_call_result_add_image_fd(McpToolCallResult* r, int fd,
+                                       const char* mime_type, const char* uri)
+{
+    struct stat st;
+    McpContentStream stream = {
+        .read = mcp_fd_read,
+        .close = mcp_fd_close,
+        .ctx = (void*)(intptr_t)fd,
+        .size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0,
+        .uri = uri,
+    };
+    return mcp_tool_call_result_add_image_stream(r, &stream, mime_type);
+}
+
+/*
+ * Base64
+ *
+ * The SIMD kernels follow Wojciech Muła's pshufb based encoder: bytes are
+ * shuffled so each 32-bit lane holds one input triplet, the four 6-bit
+ * indices are split out with two multiplies and then mapped to ASCII with
+ * a 16-entry offset table. Only whole 12/24-byte blocks go through the
+ * vector path, the scalar loop handles the rest.
+ */
+
+static const char base64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Encodes whole triplets only, returns the number of input bytes consumed */
+static size_t base64_encode_scalar(char* out, const unsigned char* in, size_t len)
+{
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t triple = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+        *out++ = base64_table[(triple >> 18) & 0x3F];
+        *out++ = base64_table[(triple >> 12) & 0x3F];
+        *out++ = base64_table[(triple >> 6) & 0x3F];
+        *out++ = base64_table[triple & 0x3F];
+    }
+    return i;
+}
+
+#ifdef MCP_BASE64_X86
+__attribute__((target("ssse3")))
+static inline __m128i base64_sse_encode_block(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t1, t3);
+
+    __m128i shift = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    shift = _mm_or_si128(shift, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                      '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(lut, shift), indices);
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_encode_ssse3(char* out, const unsigned char* in, size_t len)
+{
+    size_t i = 0;
+    /* Each load reads 16 bytes but consumes 12 */
+    for (; i + 16 <= len; i += 12, out += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)out, base64_sse_encode_block(block));
+    }
+    return i + base64_encode_scalar(out, in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t base64_encode_avx2(char* out, const unsigned char* in, size_t len)
+{
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                            4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7,
+                                            4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0,
+                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    /* Two 16-byte loads 12 bytes apart, 24 bytes consumed per round */
+    for (; i + 28 <= len; i += 24, out += 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(in + i + 12));
+        __m256i in8 = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        in8 = _mm256_shuffle_epi8(in8, shuffle);
+        __m256i t0 = _mm256_and_si256(in8, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in8, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i shift = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        shift = _mm256_or_si256(shift, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        __m256i ascii = _mm256_add_epi8(_mm256_shuffle_epi8(lut, shift), indices);
+        _mm256_storeu_si256((__m256i*)out, ascii);
+    }
+    return i + base64_encode_ssse3(out, in + i, len - i);
+}
+#endif
+
+static size_t (*base64_encode_triplets)(char*, const unsigned char*, size_t) = base64_encode_scalar;
+static pthread_once_t base64_encode_once = PTHREAD_ONCE_INIT;
+
+/* Encoders run on batch worker threads too, so pick one exactly once */
+static void base64_encode_select(void)
+{
+#ifdef MCP_BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        base64_encode_triplets = base64_encode_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        base64_encode_triplets = base64_encode_ssse3;
+#endif
+}
+
+static size_t base64_encode_dispatch(char* out, const unsigned char* in, size_t len)
+{
+    pthread_once(&base64_encode_once, base64_encode_select);
+    return base64_encode_triplets(out, in, len);
+}
+
+size_t mcp_base64_encode(char* out, const void* data, size_t len)
+{
+    const unsigned char* in = data;
+    size_t done = base64_encode_dispatch(out, in, len);
+    size_t olen = done / 3 * 4;
+
+    size_t rest = len - done;
+    if (rest > 0) {
+        uint32_t a = in[done];
+        uint32_t b = rest > 1 ? in[done + 1] : 0;
+        uint32_t triple = (a << 16) | (b << 8);
+        out[olen++] = base64_table[(triple >> 18) & 0x3F];
+        out[olen++] = base64_table[(triple >> 12) & 0x3F];
+        out[olen++] = rest > 1 ? base64_table[(triple >> 6) & 0x3F] : '=';
+        out[olen++] = '=';
+    }
+    out[olen] = '\0';
+    return olen;
+}
+
+void mcp_base64_init(McpBase64* b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+/* Make room for input_len more input bytes plus padding and NUL */
+bool mcp_base64_reserve(McpBase64* b, size_t input_len)
+{
+    size_t need = b->len + 4 * ((b->ntail + input_len + 2) / 3) + 1;
+    if (need <= b->cap)
+        return true;
+
+    size_t cap = b->cap ? b->cap : 64;
+    while (cap < need) cap *= 2;
+
+    char* data = realloc(b->data, cap);
+    if (data == NULL)
+        return false;
+
+    b->data = data;
+    b->cap = cap;
+    return true;
+}
+
+bool mcp_base64_update(McpBase64* b, const void* data, size_t len)
+{
+    const unsigned char* in = data;
+    if (len == 0)
+        return true;
+
+    if (!mcp_base64_reserve(b, len))
+        return false;
+
+    /* Complete the triplet left over from the previous chunk */
+    if (b->ntail > 0) {
+        unsigned char triple[3];
+        memcpy(triple, b->tail, b->ntail);
+        size_t take = 3 - b->ntail;
+        if (take > len) {
+            memcpy(b->tail + b->ntail, in, len);
+            b->ntail += len;
+            return true;
+        }
+        memcpy(triple + b->ntail, in, take);
+        base64_encode_scalar(b->data + b->len, triple, 3);
+        b->len += 4;
+        b->ntail = 0;
+        in += take;
+        len -= take;
+    }
+
+    size_t done = base64_encode_dispatch(b->data + b->len, in, len);
+    b->len += done / 3 * 4;
+
+    b->ntail = len - done;
+    memcpy(b->tail, in + done, b->ntail);
+    b->data[b->len] = '\0';
+    return true;
+}
+
+char* mcp_base64_finish(McpBase64* b, size_t* len)
+{
+    if (!mcp_base64_reserve(b, 0))
+        return NULL;
+
+    b->len += mcp_base64_encode(b->data + b->len, b->tail, b->ntail);
+    b->ntail = 0;
+
+    char* data = b->data;
+    if (len) *len = b->len;
+    mcp_base64_init(b);
+    return data;
+}
+
+void mcp_base64_free(McpBase64* b)
+{
+    free(b->data);
+    mcp_base64_init(b);
+}
+
 /* JSON selector made by antirez.
  *
  * You can select things like this:
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include "cJSON.h"
 
 #ifdef __cplusplus
@@ -19,6 +20,16 @@ typedef enum {
     MCP_INPUT_SCHEMA_TYPE_OBJECT = 1 << 4,
 } McpInputSchemaTypeEnum;
 
+/* C type a top level argument is decoded to, see McpTool.typed_handler */
+typedef enum {
+    MCP_ARG_NONE = 0,   /* not bound */
+    MCP_ARG_INT,        /* int */
+    MCP_ARG_DOUBLE,     /* double */
+    MCP_ARG_BOOL,       /* bool */
+    MCP_ARG_STRING,     /* const char*, valid until the call completes */
+    MCP_ARG_JSON,       /* cJSON*, valid until the call completes, NULL if absent */
+} McpArgType;
+
 typedef struct McpInputSchema {
     const char* name;
     const char* description;
@@ -26,6 +37,13 @@ typedef struct McpInputSchema {
     McpInputSchemaTypeEnum type_arr; /* only make sense for type == array */
     struct McpInputSchema* properties;
     const char** required;
+    /* Binding of a property into the tool's argument struct: its C type,
+     * offsetof() the field, and the value when the argument is absent
+     * (def_number for numbers and bools, def_string for strings) */
+    McpArgType bind;
+    size_t offset;
+    double def_number;
+    const char* def_string;
 } McpInputSchema;
 
 #define mcp_input_schema_null { .type = MCP_INPUT_SCHEMA_TYPE_NULL }
@@ -33,14 +51,29 @@ typedef struct McpInputSchema {
 typedef enum {
     MCP_CONTENT_TYPE_TEXT = 0,
     MCP_CONTENT_TYPE_IMAGE = 1,
-    MCP_CONTENT_TYPE_RESOURCE = 2
+    MCP_CONTENT_TYPE_RESOURCE = 2,
+    MCP_CONTENT_TYPE_RESOURCE_LINK = 3,
 } McpContentTypeEnum;
 
+/* Binary content produced on demand while the response is written. read()
+ * fills buf with up to len raw bytes and returns the count, 0 at the end of
+ * data or -1 on error; the bytes are base64 encoded on the fly. */
+typedef struct McpContentStream {
+    ssize_t (*read)(void* ctx, void* buf, size_t len);
+    void (*close)(void* ctx);
+    void* ctx;
+    size_t size;        /* raw size if known, 0 otherwise */
+    const char* uri;    /* linked to instead when size exceeds the inline limit */
+    const char* name;
+} McpContentStream;
+
 typedef struct McpContentItem {
     McpContentTypeEnum type;
-    char* text;
+    char* text;         /* text, or the name of a resource link */
     char* data;
     char* mime_type;
+    char* uri;
+    McpContentStream stream;
     struct McpContentItem* next;
 } McpContentItem;
 
@@ -48,13 +81,33 @@ typedef struct McpToolCallResult {
     bool is_error;
     McpContentItem* head;
     McpContentItem* tail;
+    cJSON* structured;  /* sent as structuredContent, see McpTool.output_schema */
 } McpToolCallResult;
 
+/* An asynchronous tool call in progress, see McpTool.async_handler */
+typedef struct McpCallCtx McpCallCtx;
+
 typedef struct McpTool {
     const char* name;
     const char* description;
     McpInputSchema input_schema;
+    /* Shape of the structured content of results, advertised to clients
+     * when type is set */
+    McpInputSchema output_schema;
     McpToolCallResult* (*handler)(cJSON* params);
+    /* Used instead of handler when set. Returns right away and finishes the
+     * call later with mcp_call_complete(), from any thread. params stay
+     * valid until then. Other requests are served meanwhile and responses
+     * go out in completion order. */
+    void (*async_handler)(McpCallCtx* ctx, cJSON* params);
+    /* Used instead of handler when set. Gets a struct of args_size bytes
+     * holding the bound properties of input_schema, decoded while the
+     * arguments are checked. Async handlers find it with mcp_call_args(). */
+    McpToolCallResult* (*typed_handler)(const void* args);
+    size_t args_size;
+    /* Calls running longer get an error result and are cancelled, 0 for
+     * the server default, see mcp_set_default_timeout() */
+    unsigned int timeout_ms;
 } McpTool;
 
 McpToolCallResult* mcp_tool_call_result_create();
@@ -62,15 +115,128 @@ void mcp_tool_call_result_delete(McpToolCallResult*);
 bool mcp_tool_call_result_add_text(McpToolCallResult*, const char* text);
 bool mcp_tool_call_result_add_textf(McpToolCallResult*, const char* fmt, ...);
 bool mcp_tool_call_result_add_image(McpToolCallResult*, const char* data, const char* mime_type);
+/* Like mcp_tool_call_result_add_image() but takes ownership of the malloc'd
+ * data instead of copying it. */
+bool mcp_tool_call_result_add_image_owned(McpToolCallResult*, char* data, const char* mime_type);
+/* Streamed image content, see McpContentStream. The _fd variant reads and
+ * closes fd; uri may be NULL. If a regular file no longer holds the bytes
+ * it had when added, the call is answered with an error instead. */
+bool mcp_tool_call_result_add_image_stream(McpToolCallResult*, const McpContentStream* stream, const char* mime_type);
+bool mcp_tool_call_result_add_image_fd(McpToolCallResult*, int fd, const char* mime_type, const char* uri);
+bool mcp_tool_call_result_add_resource_link(McpToolCallResult*, const char* uri, const char* name, const char* mime_type, size_t size);
+/* Structured content, an object matching the tool's output_schema. Takes
+ * ownership of it. When the result holds no text, the JSON is also sent
+ * as text, see mcp_call_wants_text(). Clients older than protocol
+ * 2025-06-18 only get that text. */
+void mcp_tool_call_result_set_structured(McpToolCallResult*, cJSON* structured);
 
 static inline void mcp_tool_call_result_set_error(McpToolCallResult* r)
 {
     r->is_error = true;
 }
 
+/* Send the result of an async call and free both. Thread safe. A NULL
+ * result ends the call without a response, like a NULL from a handler. */
+void mcp_call_complete(McpCallCtx* ctx, McpToolCallResult* result);
+
+/* True once the client cancelled the call (notifications/cancelled). Its
+ * result is then dropped, so the handler should stop and complete as soon
+ * as it notices. A NULL ctx means the call whose synchronous handler runs
+ * on this thread; false if there is none. */
+bool mcp_call_cancelled(const McpCallCtx* ctx);
+
+/* Milliseconds left before the call times out, -1 if it has no deadline.
+ * ctx as for mcp_call_cancelled(). */
+long mcp_call_remaining_ms(const McpCallCtx* ctx);
+
+/* Arguments are checked against the tool's input_schema before its handler
+ * runs: top level property types, array item types and required names. A
+ * call that does not match gets a JSON-RPC "Invalid params" error. The
+ * handler can then take each argument by the index of its property in
+ * input_schema.properties, NULL when absent. ctx as for
+ * mcp_call_cancelled(). */
+cJSON* mcp_call_arg(const McpCallCtx* ctx, int i);
+/* The struct bound arguments were decoded into, NULL unless the tool sets
+ * args_size */
+const void* mcp_call_args(const McpCallCtx* ctx);
+
+/* False if the client asked for structured content only, by setting
+ * structuredOnly in the call's _meta. Text content of results that carry
+ * structured content is then not sent, so the handler can skip rendering
+ * it. ctx as for mcp_call_cancelled(). */
+bool mcp_call_wants_text(const McpCallCtx* ctx);
+
+/* Report progress with notifications/progress, if the client passed a
+ * progressToken. done should grow from one report to the next; total is
+ * left out when <= 0 and msg when NULL. Frequent reports are thinned out.
+ * ctx as for mcp_call_cancelled(). */
+void mcp_call_progress(McpCallCtx* ctx, double done, double total, const char* msg);
+/* Like mcp_call_progress(), but also sends the content of partial, so the
+ * client can show results finished so far. partial stays the caller's and
+ * its content is not part of the final result unless added there too. */
+void mcp_call_progress_content(McpCallCtx* ctx, double done, double total,
+                               McpToolCallResult* partial);
+/* True if the client asked for progress, i.e. it is worth building partial
+ * content for mcp_call_progress_content(). */
+bool mcp_call_wants_progress(const McpCallCtx* ctx);
+
+/* Incremental base64 encoder. Feed it chunks as they arrive, then take the
+ * NUL-terminated output with mcp_base64_finish(). */
+typedef struct McpBase64 {
+    char* data;
+    size_t len;
+    size_t cap;
+    unsigned char tail[2];
+    int ntail;
+} McpBase64;
+
+void mcp_base64_init(McpBase64* b);
+bool mcp_base64_reserve(McpBase64* b, size_t input_len);
+bool mcp_base64_update(McpBase64* b, const void* data, size_t len);
+char* mcp_base64_finish(McpBase64* b, size_t* len);
+void mcp_base64_free(McpBase64* b);
+
+/* Encode len bytes into out, which must hold 4*((len+2)/3) + 1 bytes.
+ * Returns the encoded length. */
+size_t mcp_base64_encode(char* out, const void* in, size_t len);
+
 void mcp_add_tool(const McpTool* tool);
 void mcp_set_name(const char* name);
 void mcp_set_version(const char* version);
+/* Largest binary content (raw bytes) sent inline; bigger streams that carry
+ * a uri become resource links. 0, the default, means no limit. */
+void mcp_set_max_inline_size(size_t size);
+size_t mcp_get_max_inline_size(void);
+/* Responses are queued and written to stdout by a thread of their own, so
+ * a client reading slowly does not block the server. Once more than high
+ * bytes are queued, no new requests are read and handlers writing results
+ * wait, until the client has read the queue down to low. Defaults are
+ * 4 MiB and 1 MiB. */
+void mcp_set_output_watermarks(size_t high, size_t low);
+
+typedef struct McpOutputStats {
+    size_t queued_bytes;            /* waiting for the client now */
+    size_t max_queued_bytes;
+    unsigned long queued_chunks;    /* handed to the writer thread so far */
+    unsigned long reader_stalls;    /* times reading paused on a full queue */
+    double reader_stall_ms;
+    unsigned long write_stalls;     /* times stdout was not writable */
+    double write_stall_ms;
+} McpOutputStats;
+
+void mcp_get_output_stats(McpOutputStats* stats);
+
+/* JSON-RPC batches are answered with one array once every element is done.
+ * Synchronous handlers of a batch run on up to n threads, so they must be
+ * thread safe when n > 1. Default 1, one after the other. */
+void mcp_set_batch_parallel(int n);
+/* Timeout of tools that set none. 0, the default, means no limit. */
+void mcp_set_default_timeout(unsigned int ms);
+/* Called on the handler's thread right before each tool handler runs and
+ * right after it returns, even when its call already timed out, e.g. to
+ * keep shared data alive while handlers may use it. Async handlers are
+ * covered until they return, not until they complete. */
+void mcp_set_call_hooks(void (*enter)(void), void (*leave)(void));
 
 void mcp_main(int argc, const char** argv);
 
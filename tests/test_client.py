@@ -1,7 +1,10 @@
 #!/usr/bin/env python3
+import json
+import os
 import subprocess
 import sys
 import struct
+import time
 
 def send_message(proc, message):
     message += "\r\n"
@@ -12,6 +15,15 @@ def send_message(proc, message):
 def read_message(proc):
     return proc.stdout.readline()
 
+def cpu_seconds(proc):
+    with open(f"/proc/{proc.pid}/stat") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def tool_call(id, name, arguments):
+    return json.dumps({"jsonrpc": "2.0", "id": id, "method": "tools/call",
+                       "params": {"name": name, "arguments": arguments}})
+
 proc = subprocess.Popen(["./build/hello"],
                        stdin=subprocess.PIPE,
                        stdout=subprocess.PIPE,
@@ -34,6 +46,89 @@ try:
     response = read_message(proc)
     print(f"Multiply 4*6: {response}")
 
+    # A cancelled call gets no response; the next one is answered first
+    send_message(proc, tool_call(10, "wait", {"ms": 500}))
+    send_message(proc, '{"jsonrpc":"2.0","method":"notifications/cancelled","params":{"requestId":10}}')
+    send_message(proc, tool_call(11, "add", {"a": 1, "b": 2}))
+    response = read_message(proc)
+    print(f"After cancelling wait: {response}")
+    assert json.loads(response)["id"] == 11
+    # Outlasts the cancelled wait, whose response would come first
+    send_message(proc, tool_call(12, "wait", {"ms": 700}))
+    response = read_message(proc)
+    print(f"Wait 700 ms: {response}")
+    assert json.loads(response)["id"] == 12
+
+    # Past the tool's timeout the call gets an error
+    send_message(proc, tool_call(13, "wait", {"ms": 1500}))
+    response = read_message(proc)
+    print(f"Wait past the timeout: {response}")
+    result = json.loads(response)["result"]
+    assert result["isError"] and "timed out" in result["content"][0]["text"]
+
+    # A cancelled call passing its timeout while the handler still runs
+    # gets no response, and the watchdog leaves it alone
+    send_message(proc, tool_call(14, "sleep", {"ms": 1500}))
+    time.sleep(0.1)
+    send_message(proc, '{"jsonrpc":"2.0","method":"notifications/cancelled","params":{"requestId":14}}')
+    time.sleep(0.5)
+    cpu = cpu_seconds(proc)
+    time.sleep(0.8)
+    cpu = cpu_seconds(proc) - cpu
+    print(f"CPU past the cancelled call's timeout: {cpu:.2f} s")
+    assert cpu < 0.2
+    send_message(proc, tool_call(15, "add", {"a": 1, "b": 1}))
+    response = read_message(proc)
+    print(f"After the cancelled sleep: {response}")
+    assert json.loads(response)["id"] == 15
+
+    # A batch is answered with one array, notifications left out
+    batch = [json.loads(tool_call(20, "add", {"a": 2, "b": 2})),
+             json.loads(tool_call(21, "wait", {"ms": 50})),
+             {"jsonrpc": "2.0", "method": "notifications/initialized"},
+             json.loads(tool_call(22, "multiply", {"a": 3, "b": 3}))]
+    send_message(proc, json.dumps(batch))
+    response = read_message(proc)
+    print(f"Batch: {response}")
+    answers = {a["id"]: a["result"]["content"][0]["text"] for a in json.loads(response)}
+    assert answers == {20: "4", 21: "waited 50 ms", 22: "9"}
+
+    # Unknown tools are refused instead of left unanswered
+    send_message(proc, tool_call(30, "nosuch", {}))
+    response = read_message(proc)
+    print(f"Unknown tool: {response}")
+    assert json.loads(response)["error"]["code"] == -32602
+
+    # Malformed messages get a parse error with a null id, whatever id
+    # they seem to carry; well formed ones with a bad id are invalid
+    for message in ['{"jsonrpc":"2.0","id":abc,"method":"tools/list"}',
+                    '{"jsonrpc":"2.0","id":7x,"method":"tools/list"}',
+                    '{"jsonrpc":"2.0","id":31,"junk":[1,,},"method":"tools/list"}',
+                    '{"jsonrpc":"2.0","id":32,"x":nul,"method":"tools/list"}']:
+        send_message(proc, message)
+        response = read_message(proc)
+        print(f"Malformed {message}: {response}")
+        answer = json.loads(response)
+        assert answer["id"] is None and answer["error"]["code"] == -32700
+
+    send_message(proc, '{"jsonrpc":"2.0","id":{"n":33},"method":"tools/list"}')
+    response = read_message(proc)
+    print(f"Object id: {response}")
+    answer = json.loads(response)
+    assert answer["id"] is None and answer["error"]["code"] == -32600
+
+    # Arguments are checked against the input schema before the handler runs
+    send_message(proc, tool_call(40, "add", {"a": 1}))
+    response = read_message(proc)
+    print(f"Missing argument: {response}")
+    error = json.loads(response)["error"]
+    assert error["code"] == -32602 and "b" in error["message"]
+
+    send_message(proc, tool_call(41, "add", {"a": 1, "b": "2"}))
+    response = read_message(proc)
+    print(f"Wrong argument type: {response}")
+    assert json.loads(response)["error"]["code"] == -32602
+
 finally:
     proc.terminate()
     proc.wait()